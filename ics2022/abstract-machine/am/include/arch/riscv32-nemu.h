@@ -2,8 +2,7 @@
 #define ARCH_H__
 
 struct Context {
-  // TODO: fix the order of these members to match trap.S
-  uintptr_t mepc, mcause, gpr[32], mstatus;
+  uintptr_t gpr[32], mcause, mstatus, mepc;
   void *pdir;
 };
 
@@ -1,18 +1,39 @@
 #include <am.h>
+#include <nemu.h>
 #include <stdatomic.h>
 #include <klib-macros.h>
 
+#define MPE_STACK_SIZE 0x8000 // should be consistent with start.S
+
+// set by start.S at reset
+int __am_ncpu = 1;
+// other harts wait in start.S until the entry is set
+void (* volatile __am_mpe_entry)() = NULL;
+// hart i (i > 0) uses the stack below __am_mpe_stack - (i - 1) * MPE_STACK_SIZE
+uintptr_t __am_mpe_stack = 0;
+
 bool mpe_init(void (*entry)()) {
+  // the stacks of other harts are taken from the end of the heap
+  __am_mpe_stack = (uintptr_t)heap.end;
+  heap.end = (void *)((uintptr_t)heap.end - (cpu_count() - 1) * MPE_STACK_SIZE);
+  __sync_synchronize();
+  __am_mpe_entry = entry;
   entry();
   panic("MPE entry returns");
 }
 
 int cpu_count() {
-  return 1;
+  return __am_ncpu;
 }
 
 int cpu_current() {
+#if defined(__ISA_RISCV32__) || defined(__ISA_RISCV64__)
+  int hartid;
+  asm volatile ("csrr %0, mhartid" : "=r"(hartid));
+  return hartid;
+#else
   return 0;
+#endif
 }
 
 int atomic_xchg(int *addr, int newval) {
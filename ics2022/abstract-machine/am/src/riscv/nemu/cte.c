@@ -7,14 +7,14 @@ static Context* (*user_handler)(Event, Context*) = NULL;
 Context* __am_irq_handle(Context *ctx) {
   if (user_handler) {
     Event ev = {0};
-    if( ctx->mcause >= 0 && ctx->mcause < 20 )
-			ev.event = EVENT_SYSCALL;
-		else if ( ctx->mcause == -1 ) {
-      ev.event = EVENT_YIELD;
-    } else {
-      ev.event = EVENT_ERROR;
+    switch (ctx->mcause) {
+      case 8: case 9: case 11: // ecall from U, S or M-mode
+        ev.event = (ctx->GPR1 == -1 ? EVENT_YIELD : EVENT_SYSCALL);
+        ctx->mepc += 4; // return to the instruction after ecall
+        break;
+      default: ev.event = EVENT_ERROR; break;
     }
-    
+
 		ctx = user_handler(ev, ctx);
 
 		assert(ctx != NULL);
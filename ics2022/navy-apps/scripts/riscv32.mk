@@ -1,4 +1,5 @@
 CROSS_COMPILE = riscv64-linux-gnu-
 LNK_ADDR = $(if $(VME), 0x40000000, 0x83000000)
-CFLAGS  += -fno-pic -march=rv32g -mabi=ilp32
+# SOFT_FLOAT=1 avoids the F and D extensions, e.g. for NEMU without CONFIG_FPU
+CFLAGS  += -fno-pic -march=$(if $(SOFT_FLOAT),rv32ima,rv32g) -mabi=ilp32
 LDFLAGS += -melf32lriscv --no-relax -Ttext-segment $(LNK_ADDR)
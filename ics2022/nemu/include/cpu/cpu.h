@@ -18,7 +18,11 @@
 
 #include <common.h>
 
+#define NR_HART MUXDEF(CONFIG_SMP, CONFIG_NR_HART, 1)
+
 void cpu_exec(uint64_t n);
+void cpu_replay(uint64_t n);
+void cpu_idle();
 
 void set_nemu_state(int state, vaddr_t pc, int halt_ret);
 void invalid_inst(vaddr_t thispc);
@@ -24,21 +24,36 @@ void difftest_skip_ref();
 void difftest_skip_dut(int nr_ref, int nr_dut);
 void difftest_set_patch(void (*fn)(void *arg), void *arg);
 void difftest_step(vaddr_t pc, vaddr_t npc);
+void difftest_flush();
+void difftest_sync();
+void difftest_log_store(paddr_t addr, int len, word_t data);
 void difftest_detach();
 void difftest_attach();
+void difftest_fast_forward(vaddr_t pc);
 #else
 static inline void difftest_skip_ref() {}
 static inline void difftest_skip_dut(int nr_ref, int nr_dut) {}
 static inline void difftest_set_patch(void (*fn)(void *arg), void *arg) {}
 static inline void difftest_step(vaddr_t pc, vaddr_t npc) {}
+static inline void difftest_flush() {}
+static inline void difftest_sync() {}
+static inline void difftest_log_store(paddr_t addr, int len, word_t data) {}
 static inline void difftest_detach() {}
 static inline void difftest_attach() {}
+static inline void difftest_fast_forward(vaddr_t pc) {}
 #endif
 
+
 extern void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction);
 extern void (*ref_difftest_regcpy)(void *dut, bool direction);
 extern void (*ref_difftest_exec)(uint64_t n);
+extern void (*ref_difftest_exec_until)(uint64_t pc);
 extern void (*ref_difftest_raise_intr)(uint64_t NO);
+// optional interfaces, they are NULL if REF does not provide them
+extern void* (*ref_difftest_regs_map)();
+extern const uint64_t* (*ref_difftest_dirty_map)(size_t *nr_page);
+extern void (*ref_difftest_dirty_clear)();
+extern const DifftestStore* (*ref_difftest_store_log)(size_t *nr);
 
 static inline bool difftest_check_reg(const char *name, vaddr_t pc, word_t ref, word_t dut) {
   if (ref != dut) {
@@ -0,0 +1,58 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_MULDIV_H__
+#define __CPU_MULDIV_H__
+
+#include <common.h>
+
+// division by zero and overflow do not trap, see the RISC-V spec;
+// narrower operands are passed sign- or zero-extended and the result truncated
+static inline int64_t div_s(int64_t a, int64_t b) {
+  return (b == 0 ? -1 : (a == INT64_MIN && b == -1) ? a : a / b);
+}
+
+static inline int64_t rem_s(int64_t a, int64_t b) {
+  return (b == 0 ? a : (a == INT64_MIN && b == -1) ? 0 : a % b);
+}
+
+static inline uint64_t div_u(uint64_t a, uint64_t b) {
+  return (b == 0 ? UINT64_MAX : a / b);
+}
+
+static inline uint64_t rem_u(uint64_t a, uint64_t b) {
+  return (b == 0 ? a : a % b);
+}
+
+// upper half of the double-width product, for mulh/mulhsu/mulhu
+typedef MUXDEF(CONFIG_ISA64, __int128, int64_t) dsword_t;
+typedef MUXDEF(CONFIG_ISA64, unsigned __int128, uint64_t) dword_t;
+#define XLEN (sizeof(word_t) * 8)
+
+static inline word_t mulh_ss(word_t a, word_t b) {
+  return ((dsword_t)(sword_t)a * (sword_t)b) >> XLEN;
+}
+
+static inline word_t mulh_su(word_t a, word_t b) {
+  return ((dsword_t)(sword_t)a * (dsword_t)b) >> XLEN;
+}
+
+static inline word_t mulh_uu(word_t a, word_t b) {
+  return ((dword_t)a * b) >> XLEN;
+}
+
+#undef XLEN
+
+#endif
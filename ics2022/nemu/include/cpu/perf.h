@@ -0,0 +1,57 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_PERF_H__
+#define __CPU_PERF_H__
+
+#include <common.h>
+
+/* Events counted by every hart. The ISA classifies the retired
+ * instructions, and counts the traps by their causes. */
+enum {
+  PERF_LOAD, PERF_STORE, PERF_BRANCH, PERF_BRANCH_TAKEN, PERF_JUMP,
+  PERF_ALU, PERF_MULDIV, PERF_AMO, PERF_FPU, PERF_CSR, PERF_SYSTEM,
+  PERF_MMIO, PERF_EXCEPTION, PERF_INTERRUPT, PERF_IDLE,
+  NR_PERF,
+};
+
+#define NR_PERF_TRAP 32
+
+typedef struct {
+  uint64_t event[NR_PERF];
+  uint64_t exception[NR_PERF_TRAP]; // indexed by the cause
+  uint64_t interrupt[NR_PERF_TRAP];
+} PerfState;
+
+/* Event selectors seen by the guest, e.g. in mhpmevent of RISC-V:
+ * 1 + PERF_xxx for the events above, PERF_SEL_EXCEPTION + cause and
+ * PERF_SEL_INTERRUPT + cause for the traps of a cause. Other selectors
+ * count nothing. */
+#define PERF_SEL_EXCEPTION 0x100
+#define PERF_SEL_INTERRUPT 0x200
+
+#ifdef CONFIG_PERF
+#define perf_inc(ev) (nemu->perf.event[ev] ++)
+void perf_trap(bool is_intr, word_t cause);
+uint64_t perf_count(word_t sel);
+void perf_display();
+#else
+#define perf_inc(ev)
+static inline void perf_trap(bool is_intr, word_t cause) {}
+static inline uint64_t perf_count(word_t sel) { return 0; }
+static inline void perf_display() {}
+#endif
+
+#endif
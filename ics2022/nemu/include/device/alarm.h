@@ -20,5 +20,7 @@
 
 typedef void (*alarm_handler_t) ();
 void add_alarm_handle(alarm_handler_t h);
+void alarm_update();
+void alarm_skip(uint64_t n);
 
 #endif
@@ -28,8 +28,27 @@ typedef struct {
   paddr_t high;
   void *space;
   io_callback_t callback;
+  uint64_t nr_access; // counted with CONFIG_PERF
+  bool poll_idle;     // reading it in a short loop means the guest is waiting
+  bool traced;        // set by "trace dev NAME" with CONFIG_DTRACE
 } IOMap;
 
+#define NR_MAP 16
+
+// address maps and I/O space of an instance
+typedef struct IOState {
+  IOMap mmio_maps[NR_MAP];
+  int nr_mmio_map;
+  IOMap pio_maps[NR_MAP];
+  int nr_pio_map;
+  uint8_t *io_space;
+  uint8_t *p_space;
+  // the polling loop of the maps with poll_idle, see poll_check()
+  vaddr_t poll_pc;
+  uint64_t poll_inst;
+  int nr_poll;
+} IOState;
+
 static inline bool map_inside(IOMap *map, paddr_t addr) {
   return (addr >= map->low && addr <= map->high);
 }
@@ -45,11 +64,24 @@ static inline int find_mapid_by_addr(IOMap *maps, int size, paddr_t addr) {
   return -1;
 }
 
-void add_pio_map(const char *name, ioaddr_t addr,
+IOMap* add_pio_map(const char *name, ioaddr_t addr,
         void *space, uint32_t len, io_callback_t callback);
-void add_mmio_map(const char *name, paddr_t addr,
+IOMap* add_mmio_map(const char *name, paddr_t addr,
         void *space, uint32_t len, io_callback_t callback);
 
+#ifdef CONFIG_SMP
+/* Devices are shared by the harts, and only one of them may access the
+ * devices at a time, including the updates of the devices by the host. */
+void io_lock();
+void io_unlock();
+#else
+static inline void io_lock() {}
+static inline void io_unlock() {}
+#endif
+
+/* The guest is waiting for the time or an input event. */
+void device_idle();
+
 word_t map_read(paddr_t addr, int len, IOMap *map);
 void map_write(paddr_t addr, int len, word_t data, IOMap *map);
 
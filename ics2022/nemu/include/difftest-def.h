@@ -33,4 +33,14 @@ enum { DIFFTEST_TO_DUT, DIFFTEST_TO_REF };
 # error Unsupport ISA
 #endif
 
+// a store to memory retired by REF, reported by the optional
+// interface difftest_store_log(), `data` is truncated to `len` bytes
+typedef struct {
+  uint64_t addr;
+  uint64_t data;
+  int len;
+} DifftestStore;
+
+#define DIFFTEST_STORE_MASK(len) ((len) >= 8 ? ~0ull : (1ull << ((len) * 8)) - 1)
+
 #endif
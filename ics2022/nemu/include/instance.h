@@ -0,0 +1,81 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __INSTANCE_H__
+#define __INSTANCE_H__
+
+#include <isa.h>
+#include <difftest-def.h>
+#include <cpu/perf.h>
+
+/* All the state of a machine simulated by NEMU. Every thread works on its
+ * own current instance, pointed to by `nemu`, so that several machines can
+ * run in one process, one per thread. The state is accessed with the names
+ * below, e.g. `cpu` is the CPU state of the current instance.
+ */
+
+#define NR_IRINGBUF 32
+
+typedef struct NEMUInstance {
+  CPU_state cpu;
+  NEMUState state;
+  uint64_t nr_guest_inst;
+  uint64_t timer; // unit: us
+#ifdef CONFIG_VIRTUAL_TIME
+  uint64_t nr_idle_cycle; // cycles skipped by idling, they count in the virtual time
+#endif
+  bool print_step;
+#ifdef CONFIG_PERF
+  PerfState perf;
+#endif
+
+  // instruction ring buffer
+  int iring_idx;
+  char iringbuf[NR_IRINGBUF][128];
+
+  // memory
+  uint8_t *pmem;
+  uint64_t *pmem_ready; // pages initialized on demand
+  int pmem_fd;          // the file behind pmem, where the pages are initialized
+  uint64_t *pmem_dirty;
+  DifftestStore *pmem_store;
+  size_t nr_pmem_store;
+
+  // device
+  struct IOState *io;
+  struct KeyQueue *keyboard;
+} NEMUInstance;
+
+#ifdef CONFIG_TARGET_AM
+#define NEMU_TLS
+#else
+// the instance is accessed at every instruction, avoid __tls_get_addr() in the shared object
+#define NEMU_TLS __thread __attribute__((tls_model("initial-exec")))
+#endif
+
+extern NEMU_TLS NEMUInstance *nemu;
+
+#define cpu             (nemu->cpu)
+#define nemu_state      (nemu->state)
+#define g_nr_guest_inst (nemu->nr_guest_inst)
+// one instruction is retired per cycle, except for the cycles skipped by idling
+#define g_nr_guest_cycle (g_nr_guest_inst + MUXDEF(CONFIG_VIRTUAL_TIME, nemu->nr_idle_cycle, 0))
+
+NEMUInstance* nemu_new();
+NEMUInstance* nemu_new_hart(int hartid);
+void nemu_free(NEMUInstance *instance);
+NEMUInstance* nemu_switch(NEMUInstance *instance);
+
+#endif
@@ -27,11 +27,19 @@ typedef concat(__GUEST_ISA__, _ISADecodeInfo) ISADecodeInfo;
 // monitor
 extern char isa_logo[];
 void init_isa();
+void init_isa_hart(int hartid);
 
 // reg
-extern CPU_state cpu;
+// `cpu` is defined in <instance.h>
 void isa_reg_display();
 word_t isa_reg_str2val(const char *name, bool *success);
+/* the number of the register named `name` for isa_gdb_reg(),
+ * or -1 if there is no such register */
+int isa_reg_str2no(const char *name);
+/* registers in the order of the target description for GDB,
+ * return NULL if `no` is out of range */
+word_t* isa_gdb_reg(int no);
+const char* isa_gdb_tdesc();
 
 // exec
 struct Decode;
@@ -55,4 +63,6 @@ word_t isa_query_intr();
 bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc);
 void isa_difftest_attach();
 
+#include <instance.h>
+
 #endif
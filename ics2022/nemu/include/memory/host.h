@@ -38,4 +38,27 @@ static inline void host_write(void *addr, int len, word_t data) {
   }
 }
 
+/* Atomically replace the data at `addr` with `data` if it equals `*expect`.
+ * Otherwise load the current data into `*expect` and return false. */
+static inline bool host_cas(void *addr, int len, word_t *expect, word_t data) {
+  bool ok;
+  switch (len) {
+    case 4: {
+      uint32_t e = *expect;
+      ok = __atomic_compare_exchange_n((uint32_t *)addr, &e, data, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+      *expect = e;
+      return ok;
+    }
+#ifdef CONFIG_ISA64
+    case 8: {
+      uint64_t e = *expect;
+      ok = __atomic_compare_exchange_n((uint64_t *)addr, &e, data, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+      *expect = e;
+      return ok;
+    }
+#endif
+    default: MUXDEF(CONFIG_RT_CHECK, assert(0), return false);
+  }
+}
+
 #endif
@@ -17,6 +17,7 @@
 #define __MEMORY_PADDR_H__
 
 #include <common.h>
+#include <difftest-def.h>
 
 #define PMEM_LEFT  ((paddr_t)CONFIG_MBASE)
 #define PMEM_RIGHT ((paddr_t)CONFIG_MBASE + CONFIG_MSIZE - 1)
@@ -34,5 +35,53 @@ static inline bool in_pmem(paddr_t addr) {
 
 word_t paddr_read(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
+/* write `len` bytes in pmem on behalf of a debugger, they are copied to REF of difftest
+ * instead of being checked as the stores of the guest */
+void paddr_write_debug(paddr_t addr, const uint8_t *buf, int len);
+
+enum { AMO_SWAP, AMO_ADD, AMO_XOR, AMO_AND, AMO_OR, AMO_MIN, AMO_MAX, AMO_MINU, AMO_MAXU };
+/* atomically apply AMO_* `op` to the data at `addr` with `data`, return the old data */
+word_t paddr_amo(paddr_t addr, int len, int op, word_t data);
+/* atomically write `data` to `addr` if the data there is still `expect` */
+bool paddr_cas(paddr_t addr, int len, word_t expect, word_t data);
+
+#ifdef CONFIG_PMEM_MMAP
+#include <sys/types.h>
+size_t pmem_map_file(paddr_t paddr, int fd, off_t off, size_t len);
+#endif
+
+#ifdef CONFIG_SNAPSHOT
+/* whether the `len` bytes at `paddr` in a page are as they are at reset, without touching the page */
+bool pmem_is_initial(paddr_t paddr, size_t len);
+/* bring all of pmem back to its content at reset */
+void pmem_reset();
+#endif
+
+#ifdef CONFIG_WATCHPOINT
+/* stores to pmem overlapping [lo, hi] are reported to the watchpoints, lo > hi means none */
+void paddr_watch(paddr_t lo, paddr_t hi);
+#endif
+
+#ifdef CONFIG_REVERSE_EXEC
+/* An undo log records the contents of the pages in pmem before their first
+ * store since the log is opened. Opening a new log closes the previous one. */
+typedef struct PmemUndo PmemUndo;
+PmemUndo* pmem_undo_begin();
+/* write the recorded contents back to pmem */
+void pmem_undo_apply(PmemUndo *log);
+void pmem_undo_free(PmemUndo *log);
+#endif
+
+#ifdef CONFIG_PMEM_DIRTY
+/* bitmap of pages in pmem written since the last call of pmem_dirty_clear() */
+const uint64_t* pmem_dirty_map(size_t *nr_page);
+void pmem_dirty_clear();
+#endif
+
+#ifdef CONFIG_TARGET_SHARE
+/* stores to pmem since the last call of pmem_store_log_clear(), NULL if the log overflows */
+const DifftestStore* pmem_store_log(size_t *nr);
+void pmem_store_log_clear();
+#endif
 
 #endif
@@ -30,11 +30,79 @@ typedef struct {
   uint32_t halt_ret;
 } NEMUState;
 
-extern NEMUState nemu_state;
+// `nemu_state` is defined in <instance.h>
 
 // ----------- timer -----------
 
 uint64_t get_time();
+uint64_t get_guest_time();
+
+// ----------- snapshot -----------
+
+typedef void (*snapshot_callback_t)(bool is_restore);
+void snapshot_add(const char *name, void *buf, size_t size, snapshot_callback_t callback);
+bool snapshot_save(const char *file);
+bool snapshot_restore(const char *file);
+void snapshot_save_at(uint64_t nr_inst, const char *file);
+uint64_t snapshot_save_point();
+void snapshot_save_point_hit();
+
+#ifdef CONFIG_REVERSE_EXEC
+void checkpoint_enable();
+uint64_t checkpoint_next();
+uint64_t checkpoint_oldest();
+uint64_t checkpoint_take();
+bool checkpoint_rewind(uint64_t nr_inst);
+void checkpoint_clear();
+#endif
+
+// ----------- memory and device tracer -----------
+
+/* Accesses which pass the filters set by "trace" in sdb are recorded to a
+ * buffer of the thread, and the buffer is written to the trace file in
+ * bulk. The file begins with a TraceHeader, followed by `nr_dev` TraceDev,
+ * and then the records. */
+
+enum { TRACE_READ, TRACE_WRITE, TRACE_DEV_READ, TRACE_DEV_WRITE };
+
+typedef struct {
+  char magic[8]; // "NEMUTRC"
+  uint32_t record_size;
+  uint32_t nr_dev;
+} TraceHeader;
+
+typedef struct {
+  char name[16];
+  uint64_t low, high;
+} TraceDev;
+
+typedef struct {
+  uint64_t nr_inst; // instructions retired before the access
+  uint64_t pc;
+  uint64_t addr;
+  uint64_t data;
+  uint8_t type, len;
+} TraceRecord;
+
+#ifdef CONFIG_ACCESS_TRACE
+void trace_set_file(const char *file);
+bool trace_add_range(paddr_t low, paddr_t high);
+bool trace_add_dev(const char *name);
+void trace_clear();
+void trace_display();
+void trace_record(int type, paddr_t addr, int len, word_t data);
+void trace_mem(int type, paddr_t addr, int len, word_t data);
+void trace_flush();
+#endif
+
+#ifdef CONFIG_MTRACE
+// the accesses to memory are checked against the ranges only when there are some
+extern int trace_nr_range;
+#define mtrace(type, addr, len, data) \
+  do { if (unlikely(trace_nr_range > 0)) trace_mem(type, addr, len, data); } while (0)
+#else
+#define mtrace(type, addr, len, data)
+#endif
 
 // ----------- log -----------
 
@@ -0,0 +1,46 @@
+#***************************************************************************************
+# Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+#
+# NEMU is licensed under Mulan PSL v2.
+# You can use this software according to the terms and conditions of the Mulan PSL v2.
+# You may obtain a copy of Mulan PSL v2 at:
+#          http://license.coscl.org.cn/MulanPSL2
+#
+# THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+# EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+# MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+#
+# See the Mulan PSL v2 for more details.
+#**************************************************************************************/
+
+# `make bench` runs a pinned set of workloads one at a time in batch mode,
+# and writes the instructions, host time, inst/s, max RSS and startup time
+# of each of them to $(BENCH_REPORT). The report is compared with
+# $(BENCH_BASELINE) if it exists, and `make bench` fails if any workload is
+# slower than the baseline by more than $(BENCH_THRESHOLD)%.
+# `make bench-baseline` takes the last report as the baseline.
+
+BENCH_DIR       = $(BUILD_DIR)/bench
+BENCH_REPORT    = $(BENCH_DIR)/report.json
+BENCH_BASELINE ?= $(BENCH_DIR)/baseline.json
+BENCH_THRESHOLD ?= 5
+BENCH_ARCH     ?= $(GUEST_ISA)-nemu
+
+# Benchmarks are built on demand, while cpu-tests and nanos-lite (with the
+# navy apps in its ramdisk) should be built in their own directories first.
+BENCH_BUILD_IMGS ?= $(foreach b,microbench coremark,$(AM_KERNELS_HOME)/benchmarks/$(b)/build/$(b)-$(BENCH_ARCH).bin)
+BENCH_IMGS ?= $(sort $(wildcard $(AM_KERNELS_HOME)/tests/cpu-tests/build/*-$(BENCH_ARCH).bin)) \
+              $(BENCH_BUILD_IMGS) \
+              $(wildcard $(NEMU_HOME)/../nanos-lite/build/nanos-lite-$(BENCH_ARCH).bin)
+
+bench: $(BINARY) $(BENCH_BUILD_IMGS)
+	@mkdir -p $(BENCH_DIR)
+	@for img in $(BENCH_IMGS); do echo $$img; done > $(BENCH_DIR)/manifest.txt
+	@$(BINARY) --manifest=$(BENCH_DIR)/manifest.txt --jobs=1 --report=$(BENCH_REPORT) \
+	  $(if $(wildcard $(BENCH_BASELINE)),--baseline=$(BENCH_BASELINE) --threshold=$(BENCH_THRESHOLD),)
+
+bench-baseline:
+	@test -f $(BENCH_REPORT) || (echo "Run 'make bench' first"; false)
+	cp $(BENCH_REPORT) $(BENCH_BASELINE)
+
+.PHONY: bench bench-baseline
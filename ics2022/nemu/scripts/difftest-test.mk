@@ -0,0 +1,38 @@
+#***************************************************************************************
+# Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+#
+# NEMU is licensed under Mulan PSL v2.
+# You can use this software according to the terms and conditions of the Mulan PSL v2.
+# You may obtain a copy of Mulan PSL v2 at:
+#          http://license.coscl.org.cn/MulanPSL2
+#
+# THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+# EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+# MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+#
+# See the Mulan PSL v2 for more details.
+#**************************************************************************************/
+
+# `make difftest-test` runs the small images in tools/difftest-test against
+# the configured REF, e.g. spike-diff. It needs a riscv32 NEMU with
+# CONFIG_DIFFTEST and CONFIG_GDB_STUB.
+
+DT_SRC_DIR = $(NEMU_HOME)/tools/difftest-test
+DT_DIR     = $(BUILD_DIR)/difftest-test
+DT_CROSS  ?= riscv64-linux-gnu-
+
+$(DT_DIR)/%.elf: $(DT_SRC_DIR)/%.S
+	@mkdir -p $(@D)
+	$(DT_CROSS)gcc -march=rv32ima -mabi=ilp32 -nostdlib -static -Wl,-Ttext=0x80000000 -o $@ $<
+
+.PRECIOUS: $(DT_DIR)/%.elf
+$(DT_DIR)/%.bin: $(DT_DIR)/%.elf
+	$(DT_CROSS)objcopy -O binary $< $@
+
+difftest-test: $(BINARY) $(DIFF_REF_SO) $(DT_DIR)/ff.bin $(DT_DIR)/amo.bin
+	@test "$(GUEST_ISA)" = riscv32 -a -n "$(CONFIG_DIFFTEST)" -a -n "$(CONFIG_GDB_STUB)" || \
+	  (echo "difftest-test needs riscv32 with CONFIG_DIFFTEST and CONFIG_GDB_STUB"; false)
+	$(BINARY) -b -l /dev/null --diff=$(DIFF_REF_SO) $(DT_DIR)/amo.bin
+	python3 $(DT_SRC_DIR)/ff.py $(BINARY) $(DIFF_REF_SO) $(DT_DIR)/ff.elf $(DT_DIR)/ff.bin
+
+.PHONY: difftest-test
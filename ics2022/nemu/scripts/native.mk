@@ -17,6 +17,9 @@
 include $(NEMU_HOME)/scripts/build.mk
 
 include $(NEMU_HOME)/tools/difftest.mk
+include $(NEMU_HOME)/scripts/pgo.mk
+include $(NEMU_HOME)/scripts/bench.mk
+include $(NEMU_HOME)/scripts/difftest-test.mk
 
 compile_git:
 	$(call git_commit, "compile NEMU")
@@ -39,7 +42,7 @@ run: run-env
 
 gdb: run-env
 	$(call git_commit, "gdb NEMU")
-	gdb -s $(BINARY) --args $(NEMU_EXEC)
+	gdb -s $(BINARY) $(if $(CONFIG_MEM_RANDOM),-ex "handle SIGSEGV nostop noprint") --args $(NEMU_EXEC)
 
 clean-tools = $(dir $(shell find ./tools -maxdepth 2 -mindepth 2 -name "Makefile"))
 $(clean-tools):
@@ -0,0 +1,68 @@
+#***************************************************************************************
+# Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+#
+# NEMU is licensed under Mulan PSL v2.
+# You can use this software according to the terms and conditions of the Mulan PSL v2.
+# You may obtain a copy of Mulan PSL v2 at:
+#          http://license.coscl.org.cn/MulanPSL2
+#
+# THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+# EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+# MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+#
+# See the Mulan PSL v2 for more details.
+#**************************************************************************************/
+
+# Profile-guided optimization: `make pgo` builds NEMU instrumented, runs the
+# training images to collect the profile, and rebuilds NEMU with the profile
+# plus LTO. The inst/s of the training images with the plain build and with
+# the final build are written to $(PGO_RESULT).
+
+PGO_DIR    = $(BUILD_DIR)/pgo
+PGO_BUILD  = $(PGO_DIR)/build
+PGO_RESULT = $(PGO_DIR)/result.txt
+LLVM_PROFDATA ?= llvm-profdata
+
+# The training set, i.e. coremark, dhrystone and microbench in am-kernels
+AM_KERNELS_HOME ?= $(abspath $(NEMU_HOME)/../am-kernels)
+PGO_BENCH ?= coremark dhrystone microbench
+PGO_ARCH  ?= $(GUEST_ISA)-nemu
+PGO_IMGS  ?= $(foreach b,$(PGO_BENCH),$(AM_KERNELS_HOME)/benchmarks/$(b)/build/$(b)-$(PGO_ARCH).bin)
+
+$(AM_KERNELS_HOME)/benchmarks/%-$(PGO_ARCH).bin:
+	$(MAKE) -s -C $(AM_KERNELS_HOME)/benchmarks/$(word 1,$(subst /, ,$*)) ARCH=$(PGO_ARCH) image
+
+# prototype: pgo_run(binary), run the training images in batch mode and
+# print "IMAGE INST/S" for each of them
+define pgo_run
+	for img in $(PGO_IMGS); do \
+	  f=`LC_ALL=C $(1) -b -l /dev/null $$img 2>&1 | grep -ao "simulation frequency = [0-9]*" | tail -1 | grep -o "[0-9]*$$"`; \
+	  echo "`basename $$img .bin` $${f:-0}"; \
+	done
+endef
+
+pgo: $(PGO_IMGS)
+	@rm -rf $(PGO_DIR) && mkdir -p $(PGO_DIR)/profile
+	@echo "+ PGO baseline"
+	@$(MAKE) -s BUILD_DIR=$(PGO_DIR)/base
+	@echo "+ PGO instrumented build and training"
+	@$(MAKE) -s BUILD_DIR=$(PGO_BUILD) PGO_DIR=$(PGO_DIR) PGO=gen
+	@$(call pgo_run,$(PGO_BUILD)/$(NAME)) > /dev/null
+ifeq ($(CC),clang)
+	@$(LLVM_PROFDATA) merge -o $(PGO_DIR)/profile/default.profdata $(PGO_DIR)/profile/*.profraw
+endif
+	@echo "+ PGO optimized build"
+	@rm -rf $(PGO_BUILD)/obj-$(NAME) $(PGO_BUILD)/$(NAME)
+	@$(MAKE) -s BUILD_DIR=$(PGO_BUILD) PGO_DIR=$(PGO_DIR) PGO=use
+	@$(call pgo_run,$(PGO_DIR)/base/$(NAME)) > $(PGO_DIR)/base.txt
+	@$(call pgo_run,$(PGO_BUILD)/$(NAME)) > $(PGO_DIR)/pgo.txt
+	@(echo "# $(NAME) $(call remove_quote,$(CONFIG_CC_OPT)), inst/s"; \
+	  echo "image baseline pgo+lto speedup"; \
+	  paste -d ' ' $(PGO_DIR)/base.txt $(PGO_DIR)/pgo.txt | \
+	    awk '{ r = ($$2 > 0 ? $$4 / $$2 : 0); printf "%s %s %s %.3f\n", $$1, $$2, $$4, r; \
+	           if (r > 0) { s += log(r); n ++ } } \
+	         END { printf "geomean - - %.3f\n", (n > 0 ? exp(s / n) : 0) }') > $(PGO_RESULT)
+	@cat $(PGO_RESULT)
+	@echo "The optimized binary is $(PGO_BUILD)/$(NAME)"
+
+.PHONY: pgo
@@ -26,14 +26,17 @@
  */
 #define MAX_INST_TO_PRINT 10
 
-CPU_state cpu = {};
-uint64_t g_nr_guest_inst = 0;
-static uint64_t g_timer = 0; // unit: us
-static bool g_print_step = false;
-int iring_idx = 0;
-#define ring_sz 32
-char iringbuf[ring_sz][128];
+#define g_timer (nemu->timer)
+#define g_print_step (nemu->print_step)
+#define iring_idx (nemu->iring_idx)
+#define ring_sz NR_IRINGBUF
+#define iringbuf (nemu->iringbuf)
 void device_update();
+void device_idle();
+extern int wp_nr_polled;
+void wp_poll();
+extern int bp_nr;
+void bp_check(vaddr_t pc);
 
 static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
 #ifdef CONFIG_ITRACE_COND
@@ -43,6 +46,8 @@ static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
 #endif
   if (g_print_step) { IFDEF(CONFIG_ITRACE, puts(_this->logbuf)); }
   IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc));
+  IFDEF(CONFIG_WATCHPOINT, if (unlikely(wp_nr_polled > 0)) wp_poll());
+  IFDEF(CONFIG_BREAKPOINT, if (unlikely(bp_nr > 0)) bp_check(dnpc));
 }
 
 static void exec_once(Decode *s, vaddr_t pc) {
@@ -72,24 +77,108 @@ static void exec_once(Decode *s, vaddr_t pc) {
 #endif
 }
 
+#ifdef CONFIG_SMP
+#include <pthread.h>
+
+static NEMUInstance *hart[NR_HART] = {};
+static bool smp_stop = false; // set by the first hart which stops the machine
+static uint64_t smp_nr_inst = 0;
+#define is_hart0() (nemu == hart[0])
+#else
+#define is_hart0() true
+#endif
+
 static void execute(uint64_t n) {
   Decode s;
+  IFDEF(CONFIG_REVERSE_EXEC, uint64_t next_ckpt = checkpoint_next());
   for (;n > 0; n --) {
+    IFDEF(CONFIG_REVERSE_EXEC, if (unlikely(g_nr_guest_inst >= next_ckpt)) next_ckpt = checkpoint_take());
     exec_once(&s, cpu.pc);
     g_nr_guest_inst ++;
     trace_and_difftest(&s, cpu.pc);
     if (nemu_state.state != NEMU_RUNNING) break;
-    IFDEF(CONFIG_DEVICE, device_update());
+    IFDEF(CONFIG_SMP, if (unlikely(__atomic_load_n(&smp_stop, __ATOMIC_RELAXED))) break);
+    // devices are updated by only one hart
+    IFDEF(CONFIG_DEVICE, if (is_hart0()) device_update());
+  }
+  IFDEF(CONFIG_SMP, if (nemu_state.state != NEMU_RUNNING) __atomic_store_n(&smp_stop, true, __ATOMIC_RELAXED));
+  IFDEF(CONFIG_DIFFTEST, difftest_flush());
+  IFDEF(CONFIG_ACCESS_TRACE, trace_flush());
+}
+
+#ifdef CONFIG_SMP
+void init_smp() {
+  hart[0] = nemu;
+  int i;
+  for (i = 1; i < NR_HART; i ++) {
+    hart[i] = nemu_new_hart(i);
+#ifdef CONFIG_SNAPSHOT
+    char name[16];
+    snprintf(name, sizeof(name), "cpu%d", i);
+    NEMUInstance *old = nemu_switch(hart[i]);
+    snapshot_add(strdup(name), &cpu, sizeof(cpu), NULL);
+    nemu_switch(old);
+#endif
+  }
+  Log("SMP with %d harts", NR_HART);
+}
+
+static void* hart_thread(void *arg) {
+  nemu_switch(arg);
+  execute(smp_nr_inst);
+  return NULL;
+}
+
+/* Run every hart on its own host thread for `n` instructions at most,
+ * until one of them stops the machine. Hart 0 runs on the calling thread,
+ * and its state is the state of the machine. */
+static void smp_execute(uint64_t n) {
+  pthread_t thread[NR_HART];
+  int i;
+  smp_nr_inst = n;
+  smp_stop = false;
+  for (i = 1; i < NR_HART; i ++) {
+    hart[i]->state.state = NEMU_RUNNING;
+    int ret = pthread_create(&thread[i], NULL, hart_thread, hart[i]);
+    assert(ret == 0);
   }
+  execute(n);
+  for (i = 1; i < NR_HART; i ++) {
+    pthread_join(thread[i], NULL);
+    if (nemu_state.state == NEMU_RUNNING && hart[i]->state.state != NEMU_RUNNING) {
+      nemu_state = hart[i]->state;
+    }
+    hart[i]->state.state = NEMU_STOP;
+  }
+}
+#endif
+
+#ifdef CONFIG_REVERSE_EXEC
+/* Execute `n` instructions quietly to replay the execution after a checkpoint. */
+void cpu_replay(uint64_t n) {
+  g_print_step = false;
+  nemu_state.state = NEMU_RUNNING;
+  execute(n);
+  if (nemu_state.state == NEMU_RUNNING) nemu_state.state = NEMU_STOP;
+}
+#endif
+
+/* The hart has nothing to do until an interrupt or an event of the devices, e.g. by wfi. */
+void cpu_idle() {
+  IFDEF(CONFIG_IDLE, device_idle());
 }
 
 static void statistic() {
   IFNDEF(CONFIG_TARGET_AM, setlocale(LC_NUMERIC, ""));
 #define NUMBERIC_FMT MUXDEF(CONFIG_TARGET_AM, "%", "%'") PRIu64
   Log("host time spent = " NUMBERIC_FMT " us", g_timer);
-  Log("total guest instructions = " NUMBERIC_FMT, g_nr_guest_inst);
-  if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", g_nr_guest_inst * 1000000 / g_timer);
+  uint64_t nr_inst = g_nr_guest_inst;
+  IFDEF(CONFIG_SMP, for (int i = 1; i < NR_HART; i ++) nr_inst += hart[i]->nr_guest_inst);
+  Log("total guest instructions = " NUMBERIC_FMT, nr_inst);
+  IFDEF(CONFIG_VIRTUAL_TIME, Log("guest time = " NUMBERIC_FMT " us", get_guest_time()));
+  if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", nr_inst * 1000000 / g_timer);
   else Log("Finish running in less than 1 us and can not calculate the simulation frequency");
+  perf_display();
 }
 
 void print_iring_info() {
@@ -108,6 +197,11 @@ void print_iring_info() {
 }
 void assert_fail_msg() {
   isa_reg_display();
+#ifndef CONFIG_TARGET_AM
+  vaddr_t start;
+  const char *func = elf_sym_lookup(cpu.pc, &start);
+  if (func != NULL) printf("pc = " FMT_WORD " <%s+%d>\n", cpu.pc, func, (int)(cpu.pc - start));
+#endif
   print_iring_info();
   // print_stack_trace();
   statistic();
@@ -125,7 +219,18 @@ void cpu_exec(uint64_t n) {
 
   uint64_t timer_start = get_time();
 
-  execute(n);
+#ifdef CONFIG_SNAPSHOT
+  uint64_t save_point = snapshot_save_point();
+  if (save_point >= g_nr_guest_inst && save_point - g_nr_guest_inst < n) {
+    uint64_t n_before = save_point - g_nr_guest_inst;
+    MUXDEF(CONFIG_SMP, smp_execute, execute)(n_before);
+    if (nemu_state.state == NEMU_RUNNING) {
+      snapshot_save_point_hit();
+      MUXDEF(CONFIG_SMP, smp_execute, execute)(n - n_before);
+    }
+  } else
+#endif
+  MUXDEF(CONFIG_SMP, smp_execute, execute)(n);
 
   uint64_t timer_end = get_time();
   g_timer += timer_end - timer_start;
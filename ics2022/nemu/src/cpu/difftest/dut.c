@@ -17,19 +17,201 @@
 
 #include <isa.h>
 #include <cpu/cpu.h>
+#include <cpu/difftest.h>
 #include <memory/paddr.h>
+#include <memory/host.h>
+#include <memory/vaddr.h>
 #include <utils.h>
 #include <difftest-def.h>
 
 void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction) = NULL;
 void (*ref_difftest_regcpy)(void *dut, bool direction) = NULL;
 void (*ref_difftest_exec)(uint64_t n) = NULL;
+void (*ref_difftest_exec_until)(uint64_t pc) = NULL;
 void (*ref_difftest_raise_intr)(uint64_t NO) = NULL;
+void* (*ref_difftest_regs_map)() = NULL;
+const uint64_t* (*ref_difftest_dirty_map)(size_t *nr_page) = NULL;
+void (*ref_difftest_dirty_clear)() = NULL;
+const DifftestStore* (*ref_difftest_store_log)(size_t *nr) = NULL;
 
 #ifdef CONFIG_DIFFTEST
 
 static bool is_skip_ref = false;
 static int skip_dut_nr_inst = 0;
+static CPU_state *ref_regs_map = NULL;
+
+// In fast-forward mode, REF is not stepped with DUT. It catches up by free
+// running the instructions executed by DUT with a single ref_difftest_exec(),
+// which is fast if REF is backed by a fast simulator or hardware. Lockstep is
+// resumed when DUT reaches `ff_pc`, or by difftest_attach(). In the former
+// case REF runs to `ff_pc` with the optional ref_difftest_exec_until(), e.g.
+// with a breakpoint, if REF can not execute many instructions at once.
+static bool is_ff = false;
+static bool is_ff_pc = false;
+static vaddr_t ff_pc = 0;
+static vaddr_t ff_last_pc = 0;
+static uint64_t ff_nr_inst = 0;
+
+// get the registers of REF, read them in place if REF shares its CPU_state
+static CPU_state* ref_regs(CPU_state *buf) {
+  if (ref_regs_map != NULL) return ref_regs_map;
+  ref_difftest_regcpy(buf, DIFFTEST_TO_DUT);
+  return buf;
+}
+
+// Stores retired by DUT but not checked yet. They are checked with the stores
+// retired by REF, so that a wrong store is caught even if it is never loaded.
+#define MAX_STORE_PER_INST 8
+#define NR_STORE_LOG (CONFIG_DIFFTEST_BATCH * 2 + MAX_STORE_PER_INST)
+
+typedef struct {
+  paddr_t addr;
+  int len;
+  word_t old; // used to roll back the memory of REF in batch mode
+  word_t data;
+} StoreLog;
+
+static StoreLog store_log[NR_STORE_LOG];
+static int nr_store = 0;
+
+void difftest_log_store(paddr_t addr, int len, word_t data) {
+  Assert(nr_store < NR_STORE_LOG, "store log of difftest overflows");
+  store_log[nr_store ++] = (StoreLog){ .addr = addr, .len = len,
+    .old = host_read(guest_to_host(addr), len), .data = data & DIFFTEST_STORE_MASK(len) };
+}
+
+static void difftest_abort(vaddr_t pc) {
+  nemu_state.state = NEMU_ABORT;
+  nemu_state.halt_pc = pc;
+  isa_reg_display();
+}
+
+// check the stores of DUT with those retired by the last call of
+// ref_difftest_exec(), this is skipped if REF does not report them
+static bool check_stores(StoreLog *dut, int nr, vaddr_t pc, bool report) {
+  if (ref_difftest_store_log == NULL) return true;
+  size_t nr_ref;
+  const DifftestStore *ref = ref_difftest_store_log(&nr_ref);
+  if (ref == NULL) return true;
+
+  int i;
+  for (i = 0; i < nr && i < nr_ref; i ++) {
+    if (ref[i].addr != dut[i].addr || ref[i].len != dut[i].len || ref[i].data != dut[i].data) {
+      if (report) {
+        Log("store is different after executing instruction at pc = " FMT_WORD
+            ", right = (" FMT_PADDR ", %d, 0x%" PRIx64 "), wrong = (" FMT_PADDR ", %d, 0x%" PRIx64 ")",
+            pc, (paddr_t)ref[i].addr, ref[i].len, ref[i].data,
+            dut[i].addr, dut[i].len, (uint64_t)dut[i].data);
+      }
+      return false;
+    }
+  }
+  if (nr != nr_ref) {
+    if (report) {
+      Log("number of stores is different after executing instruction at pc = " FMT_WORD
+          ", right = %d, wrong = %d", pc, (int)nr_ref, nr);
+    }
+    return false;
+  }
+  return true;
+}
+
+// Compare pmem with REF. Only the pages written by DUT or REF since the
+// last checkpoint are compared if REF reports the pages it writes.
+static void checkmem(vaddr_t pc) {
+  static uint8_t buf[PAGE_SIZE];
+  size_t nr_page, nr_ref_page, i;
+  const uint64_t *dirty = pmem_dirty_map(&nr_page);
+  const uint64_t *ref_dirty = (ref_difftest_dirty_map ? ref_difftest_dirty_map(&nr_ref_page) : NULL);
+
+  for (i = 0; i < nr_page; i ++) {
+    if (ref_dirty != NULL && !(((dirty[i / 64] | ref_dirty[i / 64]) >> (i % 64)) & 1)) continue;
+    paddr_t addr = CONFIG_MBASE + i * PAGE_SIZE;
+    uint8_t *dut = guest_to_host(addr);
+    ref_difftest_memcpy(addr, buf, PAGE_SIZE, DIFFTEST_TO_DUT);
+    if (memcmp(buf, dut, PAGE_SIZE) != 0) {
+      int j;
+      for (j = 0; buf[j] == dut[j]; j ++);
+      Log("memory at " FMT_PADDR " is different at the checkpoint after pc = " FMT_WORD
+          ", right = 0x%02x, wrong = 0x%02x", addr + j, pc, buf[j], dut[j]);
+      difftest_abort(pc);
+      break;
+    }
+  }
+
+  pmem_dirty_clear();
+  if (ref_difftest_dirty_clear) ref_difftest_dirty_clear();
+}
+
+#if CONFIG_DIFFTEST_CHECKPOINT > 0
+static uint64_t nr_inst_checkpoint = 0;
+
+static void checkpoint(vaddr_t pc) {
+  // the end of the guest program is also a checkpoint
+  if (++ nr_inst_checkpoint < CONFIG_DIFFTEST_CHECKPOINT && nemu_state.state != NEMU_END) return;
+  nr_inst_checkpoint = 0;
+  difftest_flush();
+  if (nemu_state.state != NEMU_ABORT) checkmem(pc);
+}
+#else
+static void checkpoint(vaddr_t pc) {}
+#endif
+
+#if CONFIG_DIFFTEST_BATCH > 1
+// DUT commits a window of instructions to REF at once. For every instruction
+// in the window, only the words of CPU_state changed by it are logged, which
+// is enough to rebuild the DUT state after any instruction in the window.
+// The old content of pmem written in the window is also logged to roll back
+// the memory of REF before replaying the window.
+#define NR_STATE_WORD (sizeof(CPU_state) / sizeof(word_t))
+#define NR_DELTA_LOG  (CONFIG_DIFFTEST_BATCH * 4 + NR_STATE_WORD)
+
+static_assert(sizeof(CPU_state) % sizeof(word_t) == 0, "CPU_state should be an array of word_t");
+
+typedef struct {
+  vaddr_t pc;
+  uint32_t delta_end; // the deltas of this instruction end at delta_log[delta_end]
+  uint32_t store_end; // the stores of this instruction end at store_log[store_end]
+} InstLog;
+
+typedef struct {
+  uint32_t idx; // index of the word in CPU_state
+  word_t val;
+} DeltaLog;
+
+static CPU_state win_start = {}; // DUT state before the first instruction in the window
+static CPU_state win_last = {};  // DUT state after the last instruction in the window
+static InstLog inst_log[CONFIG_DIFFTEST_BATCH];
+static DeltaLog delta_log[NR_DELTA_LOG];
+static int nr_inst = 0, nr_delta = 0;
+
+static void batch_reset() {
+  win_start = win_last = cpu;
+  nr_inst = nr_delta = nr_store = 0;
+}
+
+static void batch_log(vaddr_t pc) {
+  word_t *now = (word_t *)&cpu;
+  word_t *last = (word_t *)&win_last;
+  int i;
+  for (i = 0; i < NR_STATE_WORD; i ++) {
+    if (now[i] != last[i]) {
+      delta_log[nr_delta ++] = (DeltaLog){ .idx = i, .val = now[i] };
+      last[i] = now[i];
+    }
+  }
+  inst_log[nr_inst ++] = (InstLog){ .pc = pc, .delta_end = nr_delta, .store_end = nr_store };
+}
+
+static bool batch_full() {
+  return nr_inst == CONFIG_DIFFTEST_BATCH || nr_delta + NR_STATE_WORD > NR_DELTA_LOG ||
+    nr_store + MAX_STORE_PER_INST > NR_STORE_LOG;
+}
+#else
+static void batch_reset() {
+  nr_store = 0;
+}
+#endif
 
 // this is used to let ref skip instructions which
 // can not produce consistent behavior with NEMU
@@ -52,6 +234,9 @@ void difftest_skip_ref() {
 //   Let REF run `nr_ref` instructions first.
 //   We expect that DUT will catch up with REF within `nr_dut` instructions.
 void difftest_skip_dut(int nr_ref, int nr_dut) {
+  // REF is behind DUT in fast-forward mode, it will catch up later
+  if (is_ff) return;
+  difftest_flush();
   skip_dut_nr_inst += nr_dut;
 
   while (nr_ref -- > 0) {
@@ -81,51 +266,207 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
   void (*ref_difftest_init)(int) = dlsym(handle, "difftest_init");
   assert(ref_difftest_init);
 
+  ref_difftest_regs_map = dlsym(handle, "difftest_regs_map");
+  ref_difftest_dirty_map = dlsym(handle, "difftest_dirty_map");
+  ref_difftest_dirty_clear = dlsym(handle, "difftest_dirty_clear");
+  ref_difftest_store_log = dlsym(handle, "difftest_store_log");
+  ref_difftest_exec_until = dlsym(handle, "difftest_exec_until");
+
   Log("Differential testing: %s", ANSI_FMT("ON", ANSI_FG_GREEN));
   Log("The result of every instruction will be compared with %s. "
       "This will help you a lot for debugging, but also significantly reduce the performance. "
       "If it is not necessary, you can turn it off in menuconfig.", ref_so_file);
 
   ref_difftest_init(port);
+  if (ref_difftest_regs_map != NULL) {
+    ref_regs_map = ref_difftest_regs_map();
+    Log("Registers of REF are shared with DUT");
+  }
+  if (ref_difftest_store_log != NULL) {
+    Log("Stores are checked with those retired by REF");
+  }
   ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
   ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+  batch_reset();
 }
 
 static void checkregs(CPU_state *ref, vaddr_t pc) {
   if (!isa_difftest_checkregs(ref, pc)) {
-    nemu_state.state = NEMU_ABORT;
-    nemu_state.halt_pc = pc;
-    isa_reg_display();
+    difftest_abort(pc);
+  }
+}
+
+#if CONFIG_DIFFTEST_BATCH > 1
+// check REF against the DUT state `dut`, which may be an earlier state than `cpu`
+static bool checkregs_with(CPU_state *dut, CPU_state *ref, vaddr_t pc) {
+  CPU_state now = cpu;
+  cpu = *dut;
+  checkregs(ref, pc);
+  cpu = now;
+  return nemu_state.state != NEMU_ABORT;
+}
+
+// roll REF back to the beginning of the window, then single-step it
+// to find out the first instruction producing a different result
+static void batch_replay() {
+  CPU_state buf, dut = win_start;
+  word_t *dut_word = (word_t *)&dut;
+  int i, d = 0, st = 0;
+
+  for (i = nr_store - 1; i >= 0; i --) {
+    ref_difftest_memcpy(store_log[i].addr, &store_log[i].old, store_log[i].len, DIFFTEST_TO_REF);
+  }
+  ref_difftest_regcpy(&win_start, DIFFTEST_TO_REF);
+
+  for (i = 0; i < nr_inst; i ++) {
+    for (; d < inst_log[i].delta_end; d ++) {
+      dut_word[delta_log[d].idx] = delta_log[d].val;
+    }
+    ref_difftest_exec(1);
+    if (!checkregs_with(&dut, ref_regs(&buf), inst_log[i].pc)) return;
+    if (!check_stores(store_log + st, inst_log[i].store_end - st, inst_log[i].pc, true)) {
+      CPU_state now = cpu;
+      cpu = dut;
+      difftest_abort(inst_log[i].pc);
+      cpu = now;
+      return;
+    }
+    st = inst_log[i].store_end;
+  }
+
+  Log("the window [" FMT_WORD ", " FMT_WORD "] is different from REF, "
+      "but no single instruction can be blamed",
+      inst_log[0].pc, inst_log[nr_inst - 1].pc);
+  nemu_state.state = NEMU_ABORT;
+  nemu_state.halt_pc = inst_log[nr_inst - 1].pc;
+}
+
+void difftest_flush() {
+  if (nr_inst == 0) return;
+
+  CPU_state buf;
+  ref_difftest_exec(nr_inst);
+  if (memcmp(ref_regs(&buf), &win_last, DIFFTEST_REG_SIZE) != 0 ||
+      !check_stores(store_log, nr_store, win_last.pc, false)) {
+    batch_replay();
+  }
+
+  win_start = win_last;
+  nr_inst = nr_delta = nr_store = 0;
+}
+#else
+void difftest_flush() {
+}
+#endif
+
+// copy the whole state of DUT to REF, e.g. after restoring a snapshot
+void difftest_sync() {
+  ref_difftest_memcpy(PMEM_LEFT, guest_to_host(PMEM_LEFT), CONFIG_MSIZE, DIFFTEST_TO_REF);
+  ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+  batch_reset();
+}
+
+void difftest_detach() {
+  if (is_ff) return;
+  difftest_flush();
+  is_ff = true;
+  ff_nr_inst = 0;
+}
+
+// `at_ff_pc` is true if DUT has just reached `ff_pc` for the first time since
+// REF was last synchronized, so REF can run to it without counting instructions
+static void ff_attach(bool at_ff_pc) {
+  if (!is_ff) return;
+  CPU_state buf;
+  if (at_ff_pc && ff_nr_inst > 0 && ref_difftest_exec_until != NULL) ref_difftest_exec_until(ff_pc);
+  else ref_difftest_exec(ff_nr_inst);
+  Log("REF catches up with DUT after %" PRIu64 " instructions", ff_nr_inst);
+  is_ff = false;
+  is_ff_pc = false;
+  ff_nr_inst = 0;
+  batch_reset();
+  checkregs(ref_regs(&buf), ff_last_pc);
+  if (nemu_state.state != NEMU_ABORT) checkmem(ff_last_pc);
+}
+
+void difftest_attach() {
+  ff_attach(false);
+}
+
+void difftest_fast_forward(vaddr_t pc) {
+  Log("Fast-forward REF until pc = " FMT_WORD, pc);
+  ff_pc = pc;
+  is_ff_pc = true;
+  difftest_detach();
+}
+
+static void ff_step(vaddr_t pc, vaddr_t npc) {
+  if (is_skip_ref) {
+    // let REF catch up with the instructions before this one,
+    // and copy the result of this one to REF
+    ref_difftest_exec(ff_nr_inst);
+    ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+    ff_nr_inst = 0;
+    is_skip_ref = false;
+  } else {
+    ff_nr_inst ++;
+  }
+  ff_last_pc = pc;
+  nr_store = 0;
+
+  // the end of the guest program also ends fast-forward mode
+  if ((is_ff_pc && npc == ff_pc) || nemu_state.state == NEMU_END) {
+    ff_attach(is_ff_pc && npc == ff_pc);
   }
 }
 
 void difftest_step(vaddr_t pc, vaddr_t npc) {
-  CPU_state ref_r;
+  CPU_state buf, *ref_r;
+
+  if (is_ff) {
+    ff_step(pc, npc);
+    return;
+  }
 
   if (skip_dut_nr_inst > 0) {
-    ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
-    if (ref_r.pc == npc) {
+    ref_r = ref_regs(&buf);
+    if (ref_r->pc == npc) {
       skip_dut_nr_inst = 0;
-      checkregs(&ref_r, npc);
+      checkregs(ref_r, npc);
+      batch_reset();
       return;
     }
+    batch_reset();
     skip_dut_nr_inst --;
     if (skip_dut_nr_inst == 0)
-      panic("can not catch up with ref.pc = " FMT_WORD " at pc = " FMT_WORD, ref_r.pc, pc);
+      panic("can not catch up with ref.pc = " FMT_WORD " at pc = " FMT_WORD, ref_r->pc, pc);
     return;
   }
 
   if (is_skip_ref) {
+    // let REF catch up with the instructions before this one
+    difftest_flush();
     // to skip the checking of an instruction, just copy the reg state to reference design
     ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
     is_skip_ref = false;
+    batch_reset();
+    checkpoint(pc);
     return;
   }
 
+#if CONFIG_DIFFTEST_BATCH > 1
+  batch_log(pc);
+  if (batch_full()) difftest_flush();
+#else
   ref_difftest_exec(1);
-  ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+  ref_r = ref_regs(&buf);
+  // registers of REF are compared one by one only when they are different
+  if (memcmp(ref_r, &cpu, DIFFTEST_REG_SIZE) != 0) checkregs(ref_r, pc);
+  else if (!check_stores(store_log, nr_store, pc, true)) difftest_abort(pc);
+  nr_store = 0;
+#endif
 
-  checkregs(&ref_r, pc);
+  checkpoint(pc);
 }
 #else
 void init_difftest(char *ref_so_file, long img_size, int port) { }
@@ -18,23 +18,70 @@
 #include <difftest-def.h>
 #include <memory/paddr.h>
 
+void init_mem();
+
 void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
-  assert(0);
+  if (direction == DIFFTEST_TO_REF) memcpy(guest_to_host(addr), buf, n);
+  else memcpy(buf, guest_to_host(addr), n);
 }
 
 void difftest_regcpy(void *dut, bool direction) {
-  assert(0);
+  if (direction == DIFFTEST_TO_REF) memcpy(&cpu, dut, DIFFTEST_REG_SIZE);
+  else memcpy(dut, &cpu, DIFFTEST_REG_SIZE);
 }
 
 void difftest_exec(uint64_t n) {
-  assert(0);
+  IFDEF(CONFIG_TARGET_SHARE, pmem_store_log_clear());
+  cpu_exec(n);
 }
 
 void difftest_raise_intr(word_t NO) {
-  assert(0);
+  cpu.pc = isa_raise_intr(NO, cpu.pc);
 }
 
+#ifdef CONFIG_TARGET_SHARE
+// The following interfaces are optional for DUT. They let a DUT running in
+// the same process read the registers of REF in place, and find out the
+// pages of pmem written by REF, instead of copying everything every step.
+// DUT also checks its stores against those retired by the last difftest_exec().
+
+void* difftest_regs_map() {
+  return &cpu;
+}
+
+const uint64_t* difftest_dirty_map(size_t *nr_page) {
+  return pmem_dirty_map(nr_page);
+}
+
+void difftest_dirty_clear() {
+  pmem_dirty_clear();
+}
+
+const DifftestStore* difftest_store_log(size_t *nr) {
+  return pmem_store_log(nr);
+}
+#endif
+
 void difftest_init(int port) {
+  init_mem();
   /* Perform ISA dependent initialization. */
   init_isa();
 }
+
+#ifdef CONFIG_TARGET_SHARE
+// Handles of REF instances. difftest_init() initializes the default one.
+// All the interfaces above work on the current instance of the calling
+// thread, so several threads can run their own instances concurrently.
+
+void* difftest_new() {
+  return nemu_new();
+}
+
+void difftest_free(void *handle) {
+  nemu_free(handle);
+}
+
+void* difftest_switch(void *handle) {
+  return nemu_switch(handle);
+}
+#endif
@@ -0,0 +1,87 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Performance counters of the current hart. They are shown by "info perf"
+ * in sdb and when the program ends, and are read by the guest through the
+ * counter CSRs of the ISA with the selectors in <cpu/perf.h>.
+ */
+
+#include <isa.h>
+#include <device/map.h>
+
+static const char *event_name[NR_PERF] = {
+  [PERF_LOAD] = "load", [PERF_STORE] = "store",
+  [PERF_BRANCH] = "branch", [PERF_BRANCH_TAKEN] = "branch taken", [PERF_JUMP] = "jump",
+  [PERF_ALU] = "alu", [PERF_MULDIV] = "mul/div", [PERF_AMO] = "atomic", [PERF_FPU] = "fpu",
+  [PERF_CSR] = "csr", [PERF_SYSTEM] = "system",
+  [PERF_MMIO] = "mmio", [PERF_EXCEPTION] = "exception", [PERF_INTERRUPT] = "interrupt",
+  [PERF_IDLE] = "idle",
+};
+
+void perf_trap(bool is_intr, word_t cause) {
+  perf_inc(is_intr ? PERF_INTERRUPT : PERF_EXCEPTION);
+  if (cause < NR_PERF_TRAP) (is_intr ? nemu->perf.interrupt : nemu->perf.exception)[cause] ++;
+}
+
+uint64_t perf_count(word_t sel) {
+  if (sel >= 1 && sel <= NR_PERF) return nemu->perf.event[sel - 1];
+  if (sel >= PERF_SEL_EXCEPTION && sel < PERF_SEL_EXCEPTION + NR_PERF_TRAP) {
+    return nemu->perf.exception[sel - PERF_SEL_EXCEPTION];
+  }
+  if (sel >= PERF_SEL_INTERRUPT && sel < PERF_SEL_INTERRUPT + NR_PERF_TRAP) {
+    return nemu->perf.interrupt[sel - PERF_SEL_INTERRUPT];
+  }
+  return 0;
+}
+
+static void display(const char *name, int no, uint64_t n, uint64_t total) {
+  char label[32];
+  if (no >= 0) snprintf(label, sizeof(label), "%s %d", name, no);
+  printf("  %-18s %16" PRIu64, (no >= 0 ? label : name), n);
+  if (total > 0) printf("  %6.2f%%", n * 100.0 / total);
+  printf("\n");
+}
+
+void perf_display() {
+  PerfState *p = &nemu->perf;
+  uint64_t nr_inst = nemu->nr_guest_inst;
+  int i;
+  printf("retired instructions %16" PRIu64 "\n", nr_inst);
+  for (i = 0; i < NR_PERF; i ++) {
+    if (i == PERF_MMIO) printf("events\n");
+    uint64_t total = (i == PERF_BRANCH_TAKEN ? p->event[PERF_BRANCH] : i < PERF_MMIO ? nr_inst : 0);
+    display(event_name[i], -1, p->event[i], total);
+  }
+  for (i = 0; i < NR_PERF_TRAP; i ++) {
+    if (p->exception[i]) display("exception", i, p->exception[i], 0);
+  }
+  for (i = 0; i < NR_PERF_TRAP; i ++) {
+    if (p->interrupt[i]) display("interrupt", i, p->interrupt[i], 0);
+  }
+#ifdef CONFIG_DEVICE
+  // devices are shared by the harts, and so are their counters
+  IOState *io = nemu->io;
+  if (io == NULL) return;
+  char label[32];
+  for (i = 0; i < io->nr_mmio_map; i ++) {
+    snprintf(label, sizeof(label), "mmio %s", io->mmio_maps[i].name);
+    display(label, -1, io->mmio_maps[i].nr_access, 0);
+  }
+  for (i = 0; i < io->nr_pio_map; i ++) {
+    snprintf(label, sizeof(label), "pio %s", io->pio_maps[i].name);
+    display(label, -1, io->pio_maps[i].nr_access, 0);
+  }
+#endif
+}
@@ -13,7 +13,7 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
-#include <common.h>
+#include <isa.h>
 #include <device/alarm.h>
 #include <sys/time.h>
 #include <signal.h>
@@ -35,6 +35,29 @@ static void alarm_sig_handler(int signum) {
   }
 }
 
+#ifdef CONFIG_VIRTUAL_TIME
+#define ALARM_PERIOD (CONFIG_VIRTUAL_TIME_FREQ / TIMER_HZ) // unit: cycles
+
+static uint64_t last_alarm = 0;
+
+/* Alarms are raised by the virtual time instead of a host timer, i.e.
+ * whenever the cycles reach a multiple of ALARM_PERIOD. */
+void alarm_update() {
+  uint64_t n = g_nr_guest_cycle;
+  if (likely(n - last_alarm < ALARM_PERIOD)) return;
+  bool rewound = (n < last_alarm); // e.g. by restoring a snapshot
+  last_alarm = n - n % ALARM_PERIOD;
+  if (!rewound) alarm_sig_handler(0);
+}
+
+/* Skip `n` cycles at most, but not beyond the next alarm. */
+void alarm_skip(uint64_t n) {
+  uint64_t left = last_alarm + ALARM_PERIOD - g_nr_guest_cycle;
+  nemu->nr_idle_cycle += (n < left ? n : left);
+}
+
+void init_alarm() {}
+#else
 void init_alarm() {
   struct sigaction s;
   memset(&s, 0, sizeof(s));
@@ -49,3 +72,4 @@ void init_alarm() {
   ret = setitimer(ITIMER_VIRTUAL, &it, NULL);
   Assert(ret == 0, "Can not set timer");
 }
+#endif
@@ -14,8 +14,10 @@
 ***************************************************************************************/
 
 #include <common.h>
-#include <utils.h>
+#include <instance.h>
 #include <device/alarm.h>
+#include <device/map.h>
+#include <unistd.h>
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 #endif
@@ -33,14 +35,23 @@ void init_alarm();
 void send_key(uint8_t, bool);
 void vga_update_screen();
 
+static uint64_t last_update = 0;
+
 void device_update() {
-  static uint64_t last = 0;
+#if defined(CONFIG_VIRTUAL_TIME) && !defined(CONFIG_TARGET_AM)
+  io_lock();
+  alarm_update();
+  io_unlock();
+#endif
+
+  // the screen and the events of the host are updated by the host time
   uint64_t now = get_time();
-  if (now - last < 1000000 / TIMER_HZ) {
+  if (now - last_update < 1000000 / TIMER_HZ) {
     return;
   }
-  last = now;
+  last_update = now;
 
+  io_lock();
   IFDEF(CONFIG_HAS_VGA, vga_update_screen());
 
 #ifndef CONFIG_TARGET_AM
@@ -63,8 +74,27 @@ void device_update() {
       default: break;
     }
   }
+#endif
+  io_unlock();
+}
+
+#ifdef CONFIG_IDLE
+#define IDLE_US 1000 // idle for 1 ms at most, so that short waits are not stretched much
+
+/* Sleep until the next update of the devices, which may bring an input
+ * event, or skip the cycles until the next alarm with the virtual time.
+ * The guest finds the time it waits for passed, or the event it waits for
+ * arrived, sooner. */
+void device_idle() {
+  IFDEF(CONFIG_PERF, perf_inc(PERF_IDLE));
+#ifdef CONFIG_VIRTUAL_TIME
+  alarm_skip((uint64_t)CONFIG_VIRTUAL_TIME_FREQ * IDLE_US / 1000000);
+#else
+  uint64_t next = last_update + 1000000 / TIMER_HZ, now = get_time();
+  if (now < next) usleep(next - now < IDLE_US ? next - now : IDLE_US);
 #endif
 }
+#endif
 
 void sdl_clear_event_queue() {
 #ifndef CONFIG_TARGET_AM
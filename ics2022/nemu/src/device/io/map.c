@@ -20,8 +20,17 @@
 
 #define IO_SPACE_MAX (2 * 1024 * 1024)
 
-static uint8_t *io_space = NULL;
-static uint8_t *p_space = NULL;
+#ifdef CONFIG_SMP
+#include <pthread.h>
+
+static pthread_mutex_t io_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void io_lock() { pthread_mutex_lock(&io_mutex); }
+void io_unlock() { pthread_mutex_unlock(&io_mutex); }
+#endif
+
+#define io_space (nemu->io->io_space)
+#define p_space (nemu->io->p_space)
 
 uint8_t* new_space(int size) {
   uint8_t *p = p_space;
@@ -47,31 +56,59 @@ static void invoke_callback(io_callback_t c, paddr_t offset, int len, bool is_wr
 }
 
 void init_map() {
+  nemu->io = calloc(1, sizeof(IOState));
+  assert(nemu->io);
   io_space = malloc(IO_SPACE_MAX);
   assert(io_space);
   p_space = io_space;
+  // all IOMap spaces are allocated from here
+  IFDEF(CONFIG_SNAPSHOT, snapshot_add("io", io_space, IO_SPACE_MAX, NULL));
+}
+
+#ifdef CONFIG_IDLE
+#define IDLE_LOOP 1024 // unit: instructions
+#define IDLE_POLL 16
+
+/* A guest waiting for the time or an input event usually reads the timer
+ * or the keyboard in a loop, e.g. through the system calls of Nanos-lite.
+ * The loop is recognized by the reads coming back to the same pc, while
+ * each read of such devices is within IDLE_LOOP instructions after the
+ * previous one. The devices idle after IDLE_POLL rounds of the loop. */
+static void poll_check() {
+  IOState *io = nemu->io;
+  if (io->poll_pc == 0 || g_nr_guest_inst - io->poll_inst > IDLE_LOOP) {
+    io->poll_pc = cpu.pc;
+    io->nr_poll = 0;
+  } else if (cpu.pc == io->poll_pc && ++ io->nr_poll >= IDLE_POLL) {
+    io->nr_poll = 0;
+    device_idle();
+  }
+  io->poll_inst = g_nr_guest_inst;
 }
+#endif
 
 word_t map_read(paddr_t addr, int len, IOMap *map) {
-  #ifdef CONFIG_DTRACE
-    if (map != NULL) {
-      Log("%#x\t %d \t %s", addr, len, map->name);
-    } else {
-      Log("%#x\t %d \t 'No device'", addr, len);
-    }
-  #endif
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
+  IFDEF(CONFIG_PERF, map->nr_access ++; perf_inc(PERF_MMIO));
+  IFDEF(CONFIG_IDLE, if (map->poll_idle) poll_check());
   paddr_t offset = addr - map->low;
+  io_lock();
   invoke_callback(map->callback, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
+  io_unlock();
+  IFDEF(CONFIG_DTRACE, if (unlikely(map->traced)) trace_record(TRACE_DEV_READ, addr, len, ret));
   return ret;
 }
 
 void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
+  IFDEF(CONFIG_PERF, map->nr_access ++; perf_inc(PERF_MMIO));
   paddr_t offset = addr - map->low;
+  IFDEF(CONFIG_DTRACE, if (unlikely(map->traced)) trace_record(TRACE_DEV_WRITE, addr, len, data));
+  io_lock();
   host_write(map->space + offset, len, data);
   invoke_callback(map->callback, offset, len, true);
+  io_unlock();
 }
@@ -14,7 +14,7 @@
 ***************************************************************************************/
 
 #include <device/map.h>
-#include <utils.h>
+#include <instance.h>
 
 #define KEYDOWN_MASK 0x8000
 
@@ -46,8 +46,14 @@ static void init_keymap() {
 }
 
 #define KEY_QUEUE_LEN 1024
-static int key_queue[KEY_QUEUE_LEN] = {};
-static int key_f = 0, key_r = 0;
+typedef struct KeyQueue {
+  int queue[KEY_QUEUE_LEN];
+  int f, r;
+} KeyQueue;
+
+#define key_queue (nemu->keyboard->queue)
+#define key_f (nemu->keyboard->f)
+#define key_r (nemu->keyboard->r)
 
 static void key_enqueue(uint32_t am_scancode) {
   key_queue[key_r] = am_scancode;
@@ -92,9 +98,17 @@ void init_i8042() {
   i8042_data_port_base = (uint32_t *)new_space(4);
   i8042_data_port_base[0] = _KEY_NONE;
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("keyboard", CONFIG_I8042_DATA_PORT, i8042_data_port_base, 4, i8042_data_io_handler);
+  IOMap *map = add_pio_map ("keyboard", CONFIG_I8042_DATA_PORT, i8042_data_port_base, 4, i8042_data_io_handler);
 #else
-  add_mmio_map("keyboard", CONFIG_I8042_DATA_MMIO, i8042_data_port_base, 4, i8042_data_io_handler);
+  IOMap *map = add_mmio_map("keyboard", CONFIG_I8042_DATA_MMIO, i8042_data_port_base, 4, i8042_data_io_handler);
+#endif
+  map->poll_idle = true;
+#ifndef CONFIG_TARGET_AM
+  init_keymap();
+  nemu->keyboard = calloc(1, sizeof(KeyQueue));
+  assert(nemu->keyboard);
+  IFDEF(CONFIG_SNAPSHOT, snapshot_add("key_queue", key_queue, sizeof(key_queue), NULL));
+  IFDEF(CONFIG_SNAPSHOT, snapshot_add("key_f", &key_f, sizeof(key_f), NULL));
+  IFDEF(CONFIG_SNAPSHOT, snapshot_add("key_r", &key_r, sizeof(key_r), NULL));
 #endif
-  IFNDEF(CONFIG_TARGET_AM, init_keymap());
 }
@@ -47,6 +47,7 @@ static long blk_addr = 0;
 static uint32_t addr = 0;
 static bool write_cmd = 0;
 static bool read_ext_csd = false;
+static long pos = 0; // position of `fp`, only valid in snapshot
 
 static void prepare_rw(int is_write) {
   blk_addr = base[SDARG];
@@ -122,6 +123,14 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
   }
 }
 
+#ifdef CONFIG_SNAPSHOT
+static void sdcard_snapshot(bool is_restore) {
+  if (fp == NULL) return;
+  if (is_restore) fseek(fp, pos, SEEK_SET);
+  else pos = ftell(fp);
+}
+#endif
+
 void init_sdcard() {
   base = (uint32_t *)new_space(0x80);
   add_mmio_map("sdhci", CONFIG_SDCARD_CTL_MMIO, base, 0x80, sdcard_io_handler);
@@ -131,4 +140,13 @@ void init_sdcard() {
   const char *img = CONFIG_SDCARD_IMG_PATH;
   fp = fopen(img, "r+");
   if (fp == NULL) Log("Can not find sdcard image: %s", img);
+
+#ifdef CONFIG_SNAPSHOT
+  snapshot_add("sdcard_blkcnt", &blkcnt, sizeof(blkcnt), NULL);
+  snapshot_add("sdcard_blk_addr", &blk_addr, sizeof(blk_addr), NULL);
+  snapshot_add("sdcard_addr", &addr, sizeof(addr), NULL);
+  snapshot_add("sdcard_write_cmd", &write_cmd, sizeof(write_cmd), NULL);
+  snapshot_add("sdcard_read_ext_csd", &read_ext_csd, sizeof(read_ext_csd), NULL);
+  snapshot_add("sdcard_pos", &pos, sizeof(pos), sdcard_snapshot);
+#endif
 }
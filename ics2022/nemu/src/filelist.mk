@@ -17,9 +17,21 @@ SRCS-y += src/nemu-main.c
 DIRS-y += src/cpu src/monitor src/utils
 DIRS-$(CONFIG_MODE_SYSTEM) += src/memory
 DIRS-BLACKLIST-$(CONFIG_TARGET_AM) += src/monitor/sdb
+SRCS-BLACKLIST-$(CONFIG_TARGET_AM) += src/monitor/runner.c src/monitor/elfloader.c
+
+ifdef CONFIG_GDB_STUB
+SRCS-y += tools/qemu-diff/src/protocol.c
+else
+SRCS-BLACKLIST-y += src/monitor/sdb/gdb-stub.c
+endif
+
+ifndef CONFIG_PERF
+SRCS-BLACKLIST-y += src/cpu/perf.c
+endif
 
 SHARE = $(if $(CONFIG_TARGET_SHARE),1,0)
 LIBS += $(if $(CONFIG_TARGET_NATIVE_ELF),-lreadline -ldl -pie,)
+LIBS += $(if $(CONFIG_SMP),-lpthread,)
 
 ifdef mainargs
 ASFLAGS += -DBIN_PATH=\"$(mainargs)\"
@@ -15,3 +15,9 @@
 
 INC_PATH += $(NEMU_HOME)/src/isa/$(GUEST_ISA)/include
 DIRS-y += src/isa/$(GUEST_ISA)
+
+ifdef CONFIG_FPU
+LIBS += -lm
+else
+SRCS-BLACKLIST-y += src/isa/$(GUEST_ISA)/fpu.c
+endif
@@ -18,18 +18,10 @@
 #include "../local-include/reg.h"
 
 bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc) {
-  if (ref_r->pc != pc) {
-		printf("difference at pc=%#x, ref=%#x\n", pc, ref_r->pc);
-    // todo: replace it later 
-		return true;
-	}
-  for(int i = 0; i < 32; i++){
-    if(ref_r->gpr[i] != cpu.gpr[i] ) {
-      // todo: replace it later 
-      return true;
-    }
+  for (int i = 0; i < 32; i++) {
+    if (!difftest_check_reg(reg_name(i, 4), pc, ref_r->gpr[i], gpr(i))) return false;
   }
-  return true;
+  return difftest_check_reg("pc", pc, ref_r->pc, cpu.pc);
 }
 
 void isa_difftest_attach() {
@@ -0,0 +1,256 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* The F and D extensions on top of the FPU of the host. Arithmetic runs
+ * in the rounding mode requested by the guest, and the exception flags
+ * raised by the host are accrued to fflags. Operations whose results are
+ * defined differently by RISC-V and the host (NaN propagation, min/max,
+ * comparisons and conversions to integers) are handled explicitly.
+ */
+
+#include <isa.h>
+#include <fenv.h>
+#include <math.h>
+#include "local-include/fpu.h"
+
+enum { RNE, RTZ, RDN, RUP, RMM, DYN = 7 };
+enum { NX = 1, UF = 2, OF = 4, DZ = 8, NV = 16 };
+
+typedef union { float f; uint32_t u; } F32;
+typedef union { double f; uint64_t u; } F64;
+
+#define SIGN_S 0x80000000u
+#define SIGN_D 0x8000000000000000ull
+#define CANONICAL_NAN_S 0x7fc00000u
+#define CANONICAL_NAN_D 0x7ff8000000000000ull
+
+static inline F32 unbox_s(uint64_t x) {
+  // a value which is not NaN-boxed is treated as the canonical NaN
+  return (F32){ .u = ((x >> 32) == 0xffffffff ? (uint32_t)x : CANONICAL_NAN_S) };
+}
+
+static inline F64 unbox_d(uint64_t x) {
+  return (F64){ .u = x };
+}
+
+static inline uint64_t box_s(F32 x) {
+  return FPR_BOX(isnan(x.f) ? CANONICAL_NAN_S : x.u);
+}
+
+static inline uint64_t box_d(F64 x) {
+  return (isnan(x.f) ? CANONICAL_NAN_D : x.u);
+}
+
+static inline bool is_snan(int fmt, uint64_t x) {
+  if (fmt == FP_S) {
+    uint32_t u = unbox_s(x).u;
+    return (u & 0x7fc00000u) == 0x7f800000u && (u & 0x003fffffu);
+  }
+  return (x & 0x7ff8000000000000ull) == 0x7ff0000000000000ull && (x & 0x0007ffffffffffffull);
+}
+
+// every single-precision value is exactly representable in double precision
+static inline double to_double(int fmt, uint64_t x) {
+  return (fmt == FP_S ? unbox_s(x).f : unbox_d(x).f);
+}
+
+// reserved rounding modes are rejected by fpu_rm_valid() before execution
+static int resolve_rm(int rm) {
+  return (rm == DYN ? BITS(cpu.fcsr, 7, 5) : rm);
+}
+
+bool fpu_rm_valid(int rm) {
+  return resolve_rm(rm) <= RMM;
+}
+
+// RMM is not provided by the host, and is approximated by RNE in arithmetic
+static const int host_rm[] = { FE_TONEAREST, FE_TOWARDZERO, FE_DOWNWARD, FE_UPWARD, FE_TONEAREST };
+
+/* Host operations between fpu_begin() and fpu_end() run in the rounding
+ * mode `rm`, and the exceptions they raise are accrued. Their operands and
+ * results should be volatile to keep the compiler from moving them out. */
+static inline void fpu_begin(int rm) {
+  feclearexcept(FE_ALL_EXCEPT);
+  if (rm != RNE) fesetround(host_rm[rm]);
+}
+
+static inline void fpu_end(int rm) {
+  if (rm != RNE) fesetround(FE_TONEAREST);
+  int ex = fetestexcept(FE_ALL_EXCEPT);
+  if (likely(ex == 0)) return;
+  cpu.fcsr |= ((ex & FE_INEXACT) ? NX : 0) | ((ex & FE_UNDERFLOW) ? UF : 0) |
+    ((ex & FE_OVERFLOW) ? OF : 0) | ((ex & FE_DIVBYZERO) ? DZ : 0) | ((ex & FE_INVALID) ? NV : 0);
+}
+
+#define ARITH(r, a, b, c, sqrt, fma) \
+  switch (op) { \
+    case FPU_ADD:   r = a + b; break; \
+    case FPU_SUB:   r = a - b; break; \
+    case FPU_MUL:   r = a * b; break; \
+    case FPU_DIV:   r = a / b; break; \
+    case FPU_SQRT:  r = sqrt(a); break; \
+    case FPU_MADD:  r = fma(a, b, c); break; \
+    case FPU_MSUB:  r = fma(a, b, -c); break; \
+    case FPU_NMSUB: r = fma(-a, b, c); break; \
+    case FPU_NMADD: r = fma(-a, b, -c); break; \
+    default: panic("unknown FPU operation %d", op); \
+  }
+
+static uint64_t minmax(int op, int fmt, uint64_t a, uint64_t b) {
+  double x = to_double(fmt, a), y = to_double(fmt, b);
+  if (is_snan(fmt, a) || is_snan(fmt, b)) cpu.fcsr |= NV;
+  if (isnan(x) && isnan(y)) return (fmt == FP_S ? FPR_BOX(CANONICAL_NAN_S) : CANONICAL_NAN_D);
+  if (isnan(x)) return b;
+  if (isnan(y)) return a;
+  // -0.0 is less than +0.0
+  bool lt = (x == y ? signbit(x) && !signbit(y) : x < y);
+  return ((op == FPU_MIN) == lt ? a : b);
+}
+
+uint64_t fpu_arith(int op, int fmt, uint64_t a, uint64_t b, uint64_t c, int rm) {
+  switch (op) {
+    case FPU_MIN: case FPU_MAX: return minmax(op, fmt, a, b);
+    case FPU_SGNJ: case FPU_SGNJN: case FPU_SGNJX: {
+      uint64_t sign = (fmt == FP_S ? SIGN_S : SIGN_D);
+      uint64_t x = (fmt == FP_S ? unbox_s(a).u : a), y = (fmt == FP_S ? unbox_s(b).u : b);
+      if (op == FPU_SGNJN) y = ~y;
+      uint64_t r = (op == FPU_SGNJX ? x ^ (y & sign) : (x & ~sign) | (y & sign));
+      return (fmt == FP_S ? FPR_BOX(r) : r);
+    }
+  }
+
+  rm = resolve_rm(rm);
+  if (fmt == FP_S) {
+    volatile float x = unbox_s(a).f, y = unbox_s(b).f, z = unbox_s(c).f;
+    volatile F32 r;
+    fpu_begin(rm);
+    ARITH(r.f, x, y, z, sqrtf, fmaf);
+    fpu_end(rm);
+    return box_s(r);
+  } else {
+    volatile double x = unbox_d(a).f, y = unbox_d(b).f, z = unbox_d(c).f;
+    volatile F64 r;
+    fpu_begin(rm);
+    ARITH(r.f, x, y, z, sqrt, fma);
+    fpu_end(rm);
+    return box_d(r);
+  }
+}
+
+word_t fpu_cmp(int op, int fmt, uint64_t a, uint64_t b) {
+  double x = to_double(fmt, a), y = to_double(fmt, b);
+  if (isnan(x) || isnan(y)) {
+    // feq is a quiet comparison, while flt and fle are signaling ones
+    if (op != FPU_EQ || is_snan(fmt, a) || is_snan(fmt, b)) cpu.fcsr |= NV;
+    return 0;
+  }
+  switch (op) {
+    case FPU_EQ: return x == y;
+    case FPU_LT: return x < y;
+    default:     return x <= y;
+  }
+}
+
+word_t fpu_class(int fmt, uint64_t a) {
+  int mbits = (fmt == FP_S ? 23 : 52), ebits = (fmt == FP_S ? 8 : 11);
+  uint64_t x = (fmt == FP_S ? unbox_s(a).u : a);
+  bool sign = (x >> (mbits + ebits)) & 1;
+  uint64_t e = BITS(x, mbits + ebits - 1, mbits), m = BITS(x, mbits - 1, 0);
+  if (e == BITMASK(ebits)) {
+    if (m == 0) return (sign ? 1 << 0 : 1 << 7);   // infinity
+    return (BITS(m, mbits - 1, mbits - 1) ? 1 << 9 : 1 << 8); // quiet or signaling NaN
+  }
+  if (e == 0) {
+    if (m == 0) return (sign ? 1 << 3 : 1 << 4);   // zero
+    return (sign ? 1 << 2 : 1 << 5);               // subnormal
+  }
+  return (sign ? 1 << 1 : 1 << 6);                 // normal
+}
+
+// out-of-range values and NaN saturate instead of being undefined as in C
+word_t fpu_to_int(int fmt, uint64_t a, bool is_signed, int rm) {
+  double x = to_double(fmt, a), r;
+  if (isnan(x)) {
+    cpu.fcsr |= NV;
+    return (is_signed ? INT32_MAX : UINT32_MAX);
+  }
+  switch (resolve_rm(rm)) {
+    case RTZ: r = trunc(x); break;
+    case RDN: r = floor(x); break;
+    case RUP: r = ceil(x); break;
+    case RMM: r = round(x); break;
+    default:  r = nearbyint(x); break;
+  }
+  if (r < (is_signed ? (double)INT32_MIN : 0.0)) {
+    cpu.fcsr |= NV;
+    return (is_signed ? INT32_MIN : 0);
+  }
+  if (r > (is_signed ? (double)INT32_MAX : (double)UINT32_MAX)) {
+    cpu.fcsr |= NV;
+    return (is_signed ? INT32_MAX : UINT32_MAX);
+  }
+  if (r != x) cpu.fcsr |= NX;
+  return (is_signed ? (word_t)(int32_t)r : (word_t)(uint32_t)r);
+}
+
+uint64_t fpu_from_int(int fmt, word_t x, bool is_signed, int rm) {
+  if (fmt == FP_D) {
+    // always exact
+    return (F64){ .f = (is_signed ? (double)(int32_t)x : (double)x) }.u;
+  }
+  rm = resolve_rm(rm);
+  volatile int32_t sx = x;
+  volatile uint32_t ux = x;
+  volatile F32 r;
+  fpu_begin(rm);
+  r.f = (is_signed ? (float)sx : (float)ux);
+  fpu_end(rm);
+  return FPR_BOX(r.u);
+}
+
+uint64_t fpu_cvt(int to_fmt, uint64_t a, int rm) {
+  rm = resolve_rm(rm);
+  if (to_fmt == FP_S) {
+    volatile double x = unbox_d(a).f;
+    volatile F32 r;
+    fpu_begin(rm);
+    r.f = x;
+    fpu_end(rm);
+    return box_s(r);
+  } else {
+    volatile float x = unbox_s(a).f;
+    volatile F64 r;
+    fpu_begin(RNE);
+    r.f = x;
+    fpu_end(RNE);
+    return box_d(r);
+  }
+}
+
+word_t fpu_csr_read(int csr) {
+  switch (csr) {
+    case 1:  return BITS(cpu.fcsr, 4, 0);
+    case 2:  return BITS(cpu.fcsr, 7, 5);
+    default: return BITS(cpu.fcsr, 7, 0);
+  }
+}
+
+void fpu_csr_write(int csr, word_t val) {
+  switch (csr) {
+    case 1:  cpu.fcsr = (cpu.fcsr & ~0x1f) | BITS(val, 4, 0); break;
+    case 2:  cpu.fcsr = (cpu.fcsr & ~0xe0) | (BITS(val, 2, 0) << 5); break;
+    default: cpu.fcsr = BITS(val, 7, 0); break;
+  }
+}
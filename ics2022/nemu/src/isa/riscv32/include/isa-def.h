@@ -17,12 +17,35 @@
 #define __ISA_RISCV32_H__
 
 #include <common.h>
+
+// the CSRs which are banked for the modes taking traps
+typedef struct
+{
+	word_t tvec, scratch, epc, cause, tval;
+} riscv32_TrapCSR;
+
 typedef struct
 {
 	word_t gpr[32];
-	word_t mtvec, mepc, mcause;
-	word_t mstatus;
-	vaddr_t pc;
+	vaddr_t pc; // GPRs + pc are the part synchronized with the reference design
+	int priv; // current privilege mode
+	riscv32_TrapCSR trap[4]; // indexed by the privilege mode, only S and M are used
+	word_t mstatus; // sstatus is a view of it
+	word_t medeleg, mideleg;
+	word_t mie, mip; // sie and sip are views of them
+	word_t satp;
+	word_t mhartid;
+	word_t mcounteren, scounteren;
+	word_t mhpmevent[32]; // only 3-31 are used
+	uint64_t counter_base[32]; // counter i reads as its events minus counter_base[i]
+#ifdef CONFIG_FPU
+	uint64_t fpr[32]; // single-precision values are NaN-boxed
+	word_t fcsr;
+#endif
+	// reservation set by lr, private to the hart
+	vaddr_t lr_addr;
+	word_t lr_data;
+	bool lr_valid;
 } riscv32_CPU_state;
 
 // decode
@@ -30,6 +53,7 @@ typedef struct {
   union {
     uint32_t val;
   } inst;
+  uint32_t expanded; // the 32-bit form of inst, which may be compressed
 } riscv32_ISADecodeInfo;
 
 #define isa_mmu_check(vaddr, len, type) (MMU_DIRECT)
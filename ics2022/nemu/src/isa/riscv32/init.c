@@ -15,6 +15,9 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include <cpu/cpu.h>
+#include "local-include/rvc.h"
+#include "local-include/csr.h"
 
 // this is not consistent with uint8_t
 // but it is ok since we do not access the array directly
@@ -25,18 +28,35 @@ static const uint32_t img [] = {
   0x00100073,  // ebreak (used as nemu_trap)
 };
 
-static void restart() {
+static void restart(int hartid) {
   /* Set the initial program counter. */
   cpu.pc = RESET_VECTOR;
 
   /* The zero register is always 0. */
   cpu.gpr[0] = 0;
+
+  /* Start in M-mode with MPP = M. The FPU starts in the Initial state,
+   * since the runtimes of the guest do not turn it on before using it. */
+  cpu.priv = PRV_M;
+  cpu.mstatus = MSTATUS_MPP | MUXDEF(CONFIG_FPU, MSTATUS_FS_INITIAL, 0);
+
+  /* Pass the hart ID and the number of harts to the guest in a0/a1. */
+  cpu.mhartid = hartid;
+  cpu.gpr[10] = hartid;
+  cpu.gpr[11] = NR_HART;
+}
+
+void init_isa_hart(int hartid) {
+  restart(hartid);
 }
 
 void init_isa() {
   /* Load built-in image. */
   memcpy(guest_to_host(RESET_VECTOR), img, sizeof(img));
 
+  init_rvc();
+  init_csr();
+
   /* Initialize this virtual computer system. */
-  restart();
+  restart(0);
 }
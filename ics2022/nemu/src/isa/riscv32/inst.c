@@ -14,9 +14,14 @@
  ***************************************************************************************/
 
 #include "local-include/reg.h"
+#include "local-include/rvc.h"
+#include "local-include/fpu.h"
+#include "local-include/csr.h"
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <cpu/muldiv.h>
+#include <memory/paddr.h>
 #include "../../../monitor/ftrace.h"
 
 enum
@@ -69,31 +74,42 @@ enum
 			   (BITS(i, 20, 20) << 11) | (BITS(i, 30, 21) << 1) | 0;        \
 	} while (0)
 
-void csrrwrs(word_t destination, word_t source1, word_t imm, bool tt)
+enum
 {
-	word_t t, *ptr = &gpr(0);
-	if ( imm == 773 ) {
-		ptr = &cpu.mtvec;
-	} else if ( imm == 768 ) {
-		ptr = &cpu.mstatus;
-	} else if ( imm == 833 ) {
-		ptr = &cpu.mepc;
-	} else if ( imm == 834 ) {
-		ptr = &cpu.mcause;
-	}
+	CSR_RW,
+	CSR_RS,
+	CSR_RC,
+};
 
-	t = *ptr;
-	if ( tt ) {
-		*ptr = source1;
-	} else {
-		*ptr = t | source1;
+/* csrrs and csrrc do not write the CSR if rs1 (or uimm) is x0, and csrrw
+ * does not read it if rd is x0. Illegal accesses raise an exception. */
+static void csr_access(Decode *s, int rd, word_t imm, int op, word_t src)
+{
+	int csr = imm & 0xfff;
+	word_t old = 0;
+	bool ok = (op == CSR_RW && rd == 0) || csr_read(csr, &old);
+	if (ok && (op == CSR_RW || BITS(s->isa.expanded, 19, 15) != 0))
+	{
+		ok = csr_write(csr, op == CSR_RW ? src : op == CSR_RS ? old | src : old & ~src);
 	}
-	gpr(destination) = t;
+	if (unlikely(!ok))
+	{
+		s->dnpc = isa_raise_intr(EX_II, s->pc);
+		return;
+	}
+	gpr(rd) = old;
+}
+
+// mret and sret are only allowed in their modes or higher, and sret can be trapped by mstatus.TSR
+static vaddr_t xret(Decode *s, int mode)
+{
+	bool ok = cpu.priv >= mode && !(cpu.priv == PRV_S && (cpu.mstatus & MSTATUS_TSR));
+	return (ok ? trap_return(mode) : isa_raise_intr(EX_II, s->pc));
 }
 
 static void decode_operand(Decode *s, int *dest, word_t *src1, word_t *src2, word_t *imm, int type)
 {
-	uint32_t i = s->isa.inst.val;
+	uint32_t i = s->isa.expanded;
 	int rd = BITS(i, 11, 7);
 	int rs1 = BITS(i, 19, 15);
 	int rs2 = BITS(i, 24, 20);
@@ -127,6 +143,62 @@ static void decode_operand(Decode *s, int *dest, word_t *src1, word_t *src2, wor
 	}
 }
 
+// sc succeeds only if the data at the reserved address is not changed since lr
+static word_t load_reserved(vaddr_t addr, int len)
+{
+	cpu.lr_addr = addr;
+	cpu.lr_data = vaddr_read(addr, len);
+	cpu.lr_valid = true;
+	return cpu.lr_data;
+}
+
+static word_t store_conditional(vaddr_t addr, int len, word_t data)
+{
+	bool ok = cpu.lr_valid && cpu.lr_addr == addr && vaddr_cas(addr, len, cpu.lr_data, data);
+	cpu.lr_valid = false;
+	return !ok;
+}
+
+#ifdef CONFIG_FPU
+// arithmetic and conversions of OP-FP, by inst[31:27], take a rounding mode
+#define RM_OPS ((1u << 0x00) | (1u << 0x01) | (1u << 0x02) | (1u << 0x03) | (1u << 0x08) | \
+	(1u << 0x0b) | (1u << 0x18) | (1u << 0x1a))
+
+/* FP instructions are illegal when mstatus.FS is Off, or with a reserved
+ * rounding mode. Otherwise they may modify the FP state, which becomes
+ * dirty, except for the stores. */
+static bool fp_check(uint32_t i)
+{
+	int op = BITS(i, 6, 2);
+	if (op != 0x01 && op != 0x09 && (op < 0x10 || op > 0x14))
+		return true;
+	if ((cpu.mstatus & MSTATUS_FS) == 0)
+		return false;
+	bool has_rm = (op >= 0x10 && op <= 0x13) || (op == 0x14 && ((RM_OPS >> BITS(i, 31, 27)) & 1));
+	if (has_rm && !fpu_rm_valid(BITS(i, 14, 12)))
+		return false;
+	if (op != 0x09)
+		FS_SET_DIRTY();
+	return true;
+}
+#endif
+
+/* LR, SC and AMOs need naturally aligned addresses, otherwise they raise a
+ * load (LR) or store/AMO address misaligned exception with the address in
+ * xtval. Return false if the exception is raised. */
+static bool amo_check(Decode *s)
+{
+	uint32_t i = s->isa.expanded;
+	if (BITS(i, 6, 0) != 0x2f || BITS(i, 14, 12) != 2)
+		return true;
+	vaddr_t addr = gpr(BITS(i, 19, 15));
+	if ((addr & 3) == 0)
+		return true;
+	s->dnpc = isa_raise_intr(BITS(i, 31, 27) == 0x02 ? EX_LAM : EX_SAM, s->pc);
+	cpu.trap[cpu.priv].tval = addr; // the mode taking the trap
+	return false;
+}
+
 void put_stack(Decode *s){
 //todo: later
 
@@ -136,8 +208,17 @@ static int decode_exec(Decode *s)
 	int destination = 0;
 	word_t source1 = 0, source2 = 0, immediate = 0;
 	s->dnpc = s->snpc;
+#ifdef CONFIG_FPU
+	if (unlikely(!fp_check(s->isa.expanded)))
+	{
+		s->dnpc = isa_raise_intr(EX_II, s->pc);
+		return 0;
+	}
+#endif
+	if (unlikely(!amo_check(s)))
+		return 0;
 
-#define INSTPAT_INST(s) ((s)->isa.inst.val)
+#define INSTPAT_INST(s) ((s)->isa.expanded)
 #define INSTPAT_MATCH(s, name, type, ... /* execute body */)                                  \
 	{                                                                                         \
 		decode_operand(s, &destination, &source1, &source2, &immediate, concat(TYPE_, type)); \
@@ -151,10 +232,10 @@ static int decode_exec(Decode *s)
 	// INSTPAT("??????? ????? ????? 011 ????? 00000 11", ld, I, gpr(dest) = vaddr_read(src1 + src2, 8));
 	INSTPAT("??????? ????? ????? 000 ????? 00100 11", addi, I, gpr(destination) = source1 + immediate);
 	INSTPAT("??????? ????? ????? ??? ????? 00101 11", auipc, U, gpr(destination) = s->pc + immediate);
-	INSTPAT("??????? ????? ????? ??? ????? 11011 11", jal, J, gpr(destination) = s->pc + 4; s->dnpc = s->pc + immediate);
+	INSTPAT("??????? ????? ????? ??? ????? 11011 11", jal, J, gpr(destination) = s->snpc; s->dnpc = s->pc + immediate);
 
-	// INSTPAT("??????? ????? ????? ??? ????? 11011 11", jal, J, gpr(destination) = s->pc + 4; s->dnpc = s->pc + immediate); stack_call(s->pc, s->dnpc);
-	INSTPAT("??????? ????? ????? 000 ????? 11001 11", jalr, I, gpr(destination) = s->pc + 4; s->dnpc = (source1 + immediate) ; put_stack(s) );
+	// INSTPAT("??????? ????? ????? ??? ????? 11011 11", jal, J, gpr(destination) = s->snpc; s->dnpc = s->pc + immediate); stack_call(s->pc, s->dnpc);
+	INSTPAT("??????? ????? ????? 000 ????? 11001 11", jalr, I, gpr(destination) = s->snpc; s->dnpc = (source1 + immediate) & ~(word_t)1; put_stack(s) );
 	// INSTPAT("??????? ????? ????? 000 ????? 11001 11", jalr, I, gpr(destination) = s->pc + 4; s->dnpc = (source1 + immediate) );
 	// INSTPAT("??????? ????? ????? 000 ????? 11001 11", jalr, I, gpr(destination) = s->pc + 4; s->dnpc = (source1 + immediate) & (~1));
 
@@ -176,20 +257,26 @@ static int decode_exec(Decode *s)
 	INSTPAT("??????? ????? ????? 110 ????? 00100 11", ori, I, gpr(destination) = source1 | immediate);
 	INSTPAT("0100000 ????? ????? 101 ????? 00100 11", srai, I, gpr(destination) = (int)source1 >> ((int)immediate));
 	INSTPAT("0000000 ????? ????? 101 ????? 00100 11", srli, I, gpr(destination) = source1 >> (immediate));
-	INSTPAT("??????? ????? ????? 001 ????? 11100 11", csrrw, I, csrrwrs(destination, source1, immediate, true));
-	INSTPAT("??????? ????? ????? 010 ????? 11100 11", csrrs, I, csrrwrs(destination, source1, immediate, false));
-	INSTPAT("0000000 00000 00000 000 00000 11100 11", ecall, I, s->dnpc = isa_raise_intr(cpu.gpr[17], s->snpc));
-	INSTPAT("0011000 00010 00000 000 00000 11100 11", mret, N, s->dnpc = cpu.mepc );
+	INSTPAT("??????? ????? ????? 001 ????? 11100 11", csrrw, I, csr_access(s, destination, immediate, CSR_RW, source1));
+	INSTPAT("??????? ????? ????? 010 ????? 11100 11", csrrs, I, csr_access(s, destination, immediate, CSR_RS, source1));
+	INSTPAT("??????? ????? ????? 011 ????? 11100 11", csrrc, I, csr_access(s, destination, immediate, CSR_RC, source1));
+	INSTPAT("??????? ????? ????? 101 ????? 11100 11", csrrwi, I, csr_access(s, destination, immediate, CSR_RW, BITS(INSTPAT_INST(s), 19, 15)));
+	INSTPAT("??????? ????? ????? 110 ????? 11100 11", csrrsi, I, csr_access(s, destination, immediate, CSR_RS, BITS(INSTPAT_INST(s), 19, 15)));
+	INSTPAT("??????? ????? ????? 111 ????? 11100 11", csrrci, I, csr_access(s, destination, immediate, CSR_RC, BITS(INSTPAT_INST(s), 19, 15)));
+	INSTPAT("0000000 00000 00000 000 00000 11100 11", ecall, N, s->dnpc = isa_raise_intr(EX_ECU + cpu.priv, s->pc));
+	INSTPAT("0011000 00010 00000 000 00000 11100 11", mret, N, s->dnpc = xret(s, PRV_M));
+	INSTPAT("0001000 00010 00000 000 00000 11100 11", sret, N, s->dnpc = xret(s, PRV_S));
+	INSTPAT("0001000 00101 00000 000 00000 11100 11", wfi, N, cpu_idle());
 	INSTPAT("0000000 ????? ????? 000 ????? 01100 11", add, R, gpr(destination) = source1 + source2);
 	INSTPAT("0100000 ????? ????? 000 ????? 01100 11", sub, R, gpr(destination) = source1 - source2);
 	INSTPAT("0000001 ????? ????? 000 ????? 01100 11", mul, R, gpr(destination) = source1 * source2);
-	INSTPAT("0000001 ????? ????? 011 ????? 01100 11", mulhu, R, gpr(destination) = (((long long)source1 * (long long)source2) >> 32));
-	INSTPAT("0000001 ????? ????? 001 ????? 01100 11", mulh, R, gpr(destination) = (int)((SEXT((long long)source1, 32) * SEXT((long long)source2, 32)) >> 32));
-	INSTPAT("0000001 ????? ????? 010 ????? 01100 11", mulhsu, R, gpr(destination) = (((long long)source1 * SEXT((long long)source2, 32)) >> 32));
-	INSTPAT("0000001 ????? ????? 100 ????? 01100 11", div, R, gpr(destination) = (int)source1 / (int)source2);
-	INSTPAT("0000001 ????? ????? 101 ????? 01100 11", divu, R, gpr(destination) = source1 / source2);
-	INSTPAT("0000001 ????? ????? 110 ????? 01100 11", rem, R, gpr(destination) = (int)source1 % (int)source2);
-	INSTPAT("0000001 ????? ????? 111 ????? 01100 11", remu, R, gpr(destination) = source1 % source2);
+	INSTPAT("0000001 ????? ????? 011 ????? 01100 11", mulhu, R, gpr(destination) = mulh_uu(source1, source2));
+	INSTPAT("0000001 ????? ????? 001 ????? 01100 11", mulh, R, gpr(destination) = mulh_ss(source1, source2));
+	INSTPAT("0000001 ????? ????? 010 ????? 01100 11", mulhsu, R, gpr(destination) = mulh_su(source1, source2));
+	INSTPAT("0000001 ????? ????? 100 ????? 01100 11", div, R, gpr(destination) = div_s((int32_t)source1, (int32_t)source2));
+	INSTPAT("0000001 ????? ????? 101 ????? 01100 11", divu, R, gpr(destination) = div_u(source1, source2));
+	INSTPAT("0000001 ????? ????? 110 ????? 01100 11", rem, R, gpr(destination) = rem_s((int32_t)source1, (int32_t)source2));
+	INSTPAT("0000001 ????? ????? 111 ????? 01100 11", remu, R, gpr(destination) = rem_u(source1, source2));
 	INSTPAT("0000000 ????? ????? 001 ????? 01100 11", sll, R, gpr(destination) = source1 << source2);
 	INSTPAT("0100000 ????? ????? 101 ????? 01100 11", sra, R, gpr(destination) = (int)source1 >> ((int)source2));
 	INSTPAT("0000000 ????? ????? 101 ????? 01100 11", srl, R, gpr(destination) = source1 >> (source2));
@@ -200,6 +287,85 @@ static int decode_exec(Decode *s)
 	INSTPAT("0000000 ????? ????? 100 ????? 01100 11", xor, R, gpr(destination) = source1 ^ source2);
 	INSTPAT("??????? ????? ????? 000 ????? 01000 11", sb, S, vaddr_write(source1 + immediate, 1, source2));
 	INSTPAT("??????? ????? ????? 001 ????? 01000 11", sh, S, vaddr_write(source1 + immediate, 2, source2));
+	INSTPAT("???? ???? ???? ????? 000 ????? 00011 11", fence, N, __atomic_thread_fence(__ATOMIC_SEQ_CST));
+	INSTPAT("???? ???? ???? ????? 001 ????? 00011 11", fence.i, N, );
+	INSTPAT("00010?? 00000 ????? 010 ????? 01011 11", lr.w, R, gpr(destination) = load_reserved(source1, 4));
+	INSTPAT("00011?? ????? ????? 010 ????? 01011 11", sc.w, R, gpr(destination) = store_conditional(source1, 4, source2));
+	INSTPAT("00001?? ????? ????? 010 ????? 01011 11", amoswap.w, R, gpr(destination) = vaddr_amo(source1, 4, AMO_SWAP, source2));
+	INSTPAT("00000?? ????? ????? 010 ????? 01011 11", amoadd.w, R, gpr(destination) = vaddr_amo(source1, 4, AMO_ADD, source2));
+	INSTPAT("00100?? ????? ????? 010 ????? 01011 11", amoxor.w, R, gpr(destination) = vaddr_amo(source1, 4, AMO_XOR, source2));
+	INSTPAT("01100?? ????? ????? 010 ????? 01011 11", amoand.w, R, gpr(destination) = vaddr_amo(source1, 4, AMO_AND, source2));
+	INSTPAT("01000?? ????? ????? 010 ????? 01011 11", amoor.w, R, gpr(destination) = vaddr_amo(source1, 4, AMO_OR, source2));
+	INSTPAT("10000?? ????? ????? 010 ????? 01011 11", amomin.w, R, gpr(destination) = vaddr_amo(source1, 4, AMO_MIN, source2));
+	INSTPAT("10100?? ????? ????? 010 ????? 01011 11", amomax.w, R, gpr(destination) = vaddr_amo(source1, 4, AMO_MAX, source2));
+	INSTPAT("11000?? ????? ????? 010 ????? 01011 11", amominu.w, R, gpr(destination) = vaddr_amo(source1, 4, AMO_MINU, source2));
+	INSTPAT("11100?? ????? ????? 010 ????? 01011 11", amomaxu.w, R, gpr(destination) = vaddr_amo(source1, 4, AMO_MAXU, source2));
+
+#ifdef CONFIG_FPU
+#define fpr_rs1 cpu.fpr[BITS(INSTPAT_INST(s), 19, 15)]
+#define fpr_rs2 cpu.fpr[BITS(INSTPAT_INST(s), 24, 20)]
+#define fpr_rs3 cpu.fpr[BITS(INSTPAT_INST(s), 31, 27)]
+#define fpr_rd  cpu.fpr[destination]
+#define rm      BITS(INSTPAT_INST(s), 14, 12)
+	INSTPAT("??????? ????? ????? 010 ????? 00001 11", flw, I, fpr_rd = FPR_BOX(vaddr_read(source1 + immediate, 4)));
+	INSTPAT("??????? ????? ????? 011 ????? 00001 11", fld, I, fpr_rd = vaddr_read(source1 + immediate, 4) | (uint64_t)vaddr_read(source1 + immediate + 4, 4) << 32);
+	INSTPAT("??????? ????? ????? 010 ????? 01001 11", fsw, S, vaddr_write(source1 + immediate, 4, fpr_rs2));
+	INSTPAT("??????? ????? ????? 011 ????? 01001 11", fsd, S, vaddr_write(source1 + immediate, 4, fpr_rs2); vaddr_write(source1 + immediate + 4, 4, fpr_rs2 >> 32));
+	INSTPAT("????? 00 ????? ????? ??? ????? 10000 11", fmadd.s, R, fpr_rd = fpu_arith(FPU_MADD, FP_S, fpr_rs1, fpr_rs2, fpr_rs3, rm));
+	INSTPAT("????? 00 ????? ????? ??? ????? 10001 11", fmsub.s, R, fpr_rd = fpu_arith(FPU_MSUB, FP_S, fpr_rs1, fpr_rs2, fpr_rs3, rm));
+	INSTPAT("????? 00 ????? ????? ??? ????? 10010 11", fnmsub.s, R, fpr_rd = fpu_arith(FPU_NMSUB, FP_S, fpr_rs1, fpr_rs2, fpr_rs3, rm));
+	INSTPAT("????? 00 ????? ????? ??? ????? 10011 11", fnmadd.s, R, fpr_rd = fpu_arith(FPU_NMADD, FP_S, fpr_rs1, fpr_rs2, fpr_rs3, rm));
+	INSTPAT("????? 01 ????? ????? ??? ????? 10000 11", fmadd.d, R, fpr_rd = fpu_arith(FPU_MADD, FP_D, fpr_rs1, fpr_rs2, fpr_rs3, rm));
+	INSTPAT("????? 01 ????? ????? ??? ????? 10001 11", fmsub.d, R, fpr_rd = fpu_arith(FPU_MSUB, FP_D, fpr_rs1, fpr_rs2, fpr_rs3, rm));
+	INSTPAT("????? 01 ????? ????? ??? ????? 10010 11", fnmsub.d, R, fpr_rd = fpu_arith(FPU_NMSUB, FP_D, fpr_rs1, fpr_rs2, fpr_rs3, rm));
+	INSTPAT("????? 01 ????? ????? ??? ????? 10011 11", fnmadd.d, R, fpr_rd = fpu_arith(FPU_NMADD, FP_D, fpr_rs1, fpr_rs2, fpr_rs3, rm));
+	INSTPAT("0000000 ????? ????? ??? ????? 10100 11", fadd.s, R, fpr_rd = fpu_arith(FPU_ADD, FP_S, fpr_rs1, fpr_rs2, 0, rm));
+	INSTPAT("0000100 ????? ????? ??? ????? 10100 11", fsub.s, R, fpr_rd = fpu_arith(FPU_SUB, FP_S, fpr_rs1, fpr_rs2, 0, rm));
+	INSTPAT("0001000 ????? ????? ??? ????? 10100 11", fmul.s, R, fpr_rd = fpu_arith(FPU_MUL, FP_S, fpr_rs1, fpr_rs2, 0, rm));
+	INSTPAT("0001100 ????? ????? ??? ????? 10100 11", fdiv.s, R, fpr_rd = fpu_arith(FPU_DIV, FP_S, fpr_rs1, fpr_rs2, 0, rm));
+	INSTPAT("0101100 00000 ????? ??? ????? 10100 11", fsqrt.s, R, fpr_rd = fpu_arith(FPU_SQRT, FP_S, fpr_rs1, 0, 0, rm));
+	INSTPAT("0010000 ????? ????? 000 ????? 10100 11", fsgnj.s, R, fpr_rd = fpu_arith(FPU_SGNJ, FP_S, fpr_rs1, fpr_rs2, 0, rm));
+	INSTPAT("0010000 ????? ????? 001 ????? 10100 11", fsgnjn.s, R, fpr_rd = fpu_arith(FPU_SGNJN, FP_S, fpr_rs1, fpr_rs2, 0, rm));
+	INSTPAT("0010000 ????? ????? 010 ????? 10100 11", fsgnjx.s, R, fpr_rd = fpu_arith(FPU_SGNJX, FP_S, fpr_rs1, fpr_rs2, 0, rm));
+	INSTPAT("0010100 ????? ????? 000 ????? 10100 11", fmin.s, R, fpr_rd = fpu_arith(FPU_MIN, FP_S, fpr_rs1, fpr_rs2, 0, rm));
+	INSTPAT("0010100 ????? ????? 001 ????? 10100 11", fmax.s, R, fpr_rd = fpu_arith(FPU_MAX, FP_S, fpr_rs1, fpr_rs2, 0, rm));
+	INSTPAT("0000001 ????? ????? ??? ????? 10100 11", fadd.d, R, fpr_rd = fpu_arith(FPU_ADD, FP_D, fpr_rs1, fpr_rs2, 0, rm));
+	INSTPAT("0000101 ????? ????? ??? ????? 10100 11", fsub.d, R, fpr_rd = fpu_arith(FPU_SUB, FP_D, fpr_rs1, fpr_rs2, 0, rm));
+	INSTPAT("0001001 ????? ????? ??? ????? 10100 11", fmul.d, R, fpr_rd = fpu_arith(FPU_MUL, FP_D, fpr_rs1, fpr_rs2, 0, rm));
+	INSTPAT("0001101 ????? ????? ??? ????? 10100 11", fdiv.d, R, fpr_rd = fpu_arith(FPU_DIV, FP_D, fpr_rs1, fpr_rs2, 0, rm));
+	INSTPAT("0101101 00000 ????? ??? ????? 10100 11", fsqrt.d, R, fpr_rd = fpu_arith(FPU_SQRT, FP_D, fpr_rs1, 0, 0, rm));
+	INSTPAT("0010001 ????? ????? 000 ????? 10100 11", fsgnj.d, R, fpr_rd = fpu_arith(FPU_SGNJ, FP_D, fpr_rs1, fpr_rs2, 0, rm));
+	INSTPAT("0010001 ????? ????? 001 ????? 10100 11", fsgnjn.d, R, fpr_rd = fpu_arith(FPU_SGNJN, FP_D, fpr_rs1, fpr_rs2, 0, rm));
+	INSTPAT("0010001 ????? ????? 010 ????? 10100 11", fsgnjx.d, R, fpr_rd = fpu_arith(FPU_SGNJX, FP_D, fpr_rs1, fpr_rs2, 0, rm));
+	INSTPAT("0010101 ????? ????? 000 ????? 10100 11", fmin.d, R, fpr_rd = fpu_arith(FPU_MIN, FP_D, fpr_rs1, fpr_rs2, 0, rm));
+	INSTPAT("0010101 ????? ????? 001 ????? 10100 11", fmax.d, R, fpr_rd = fpu_arith(FPU_MAX, FP_D, fpr_rs1, fpr_rs2, 0, rm));
+	INSTPAT("0100000 00001 ????? ??? ????? 10100 11", fcvt.s.d, R, fpr_rd = fpu_cvt(FP_S, fpr_rs1, rm));
+	INSTPAT("0100001 00000 ????? ??? ????? 10100 11", fcvt.d.s, R, fpr_rd = fpu_cvt(FP_D, fpr_rs1, rm));
+	INSTPAT("1010000 ????? ????? 010 ????? 10100 11", feq.s, R, gpr(destination) = fpu_cmp(FPU_EQ, FP_S, fpr_rs1, fpr_rs2));
+	INSTPAT("1010000 ????? ????? 001 ????? 10100 11", flt.s, R, gpr(destination) = fpu_cmp(FPU_LT, FP_S, fpr_rs1, fpr_rs2));
+	INSTPAT("1010000 ????? ????? 000 ????? 10100 11", fle.s, R, gpr(destination) = fpu_cmp(FPU_LE, FP_S, fpr_rs1, fpr_rs2));
+	INSTPAT("1010001 ????? ????? 010 ????? 10100 11", feq.d, R, gpr(destination) = fpu_cmp(FPU_EQ, FP_D, fpr_rs1, fpr_rs2));
+	INSTPAT("1010001 ????? ????? 001 ????? 10100 11", flt.d, R, gpr(destination) = fpu_cmp(FPU_LT, FP_D, fpr_rs1, fpr_rs2));
+	INSTPAT("1010001 ????? ????? 000 ????? 10100 11", fle.d, R, gpr(destination) = fpu_cmp(FPU_LE, FP_D, fpr_rs1, fpr_rs2));
+	INSTPAT("1100000 00000 ????? ??? ????? 10100 11", fcvt.w.s, R, gpr(destination) = fpu_to_int(FP_S, fpr_rs1, true, rm));
+	INSTPAT("1100000 00001 ????? ??? ????? 10100 11", fcvt.wu.s, R, gpr(destination) = fpu_to_int(FP_S, fpr_rs1, false, rm));
+	INSTPAT("1100001 00000 ????? ??? ????? 10100 11", fcvt.w.d, R, gpr(destination) = fpu_to_int(FP_D, fpr_rs1, true, rm));
+	INSTPAT("1100001 00001 ????? ??? ????? 10100 11", fcvt.wu.d, R, gpr(destination) = fpu_to_int(FP_D, fpr_rs1, false, rm));
+	INSTPAT("1101000 00000 ????? ??? ????? 10100 11", fcvt.s.w, R, fpr_rd = fpu_from_int(FP_S, source1, true, rm));
+	INSTPAT("1101000 00001 ????? ??? ????? 10100 11", fcvt.s.wu, R, fpr_rd = fpu_from_int(FP_S, source1, false, rm));
+	INSTPAT("1101001 00000 ????? ??? ????? 10100 11", fcvt.d.w, R, fpr_rd = fpu_from_int(FP_D, source1, true, rm));
+	INSTPAT("1101001 00001 ????? ??? ????? 10100 11", fcvt.d.wu, R, fpr_rd = fpu_from_int(FP_D, source1, false, rm));
+	INSTPAT("1110000 00000 ????? 000 ????? 10100 11", fmv.x.w, R, gpr(destination) = (uint32_t)fpr_rs1);
+	INSTPAT("1110000 00000 ????? 001 ????? 10100 11", fclass.s, R, gpr(destination) = fpu_class(FP_S, fpr_rs1));
+	INSTPAT("1110001 00000 ????? 001 ????? 10100 11", fclass.d, R, gpr(destination) = fpu_class(FP_D, fpr_rs1));
+	INSTPAT("1111000 00000 ????? 000 ????? 10100 11", fmv.w.x, R, fpr_rd = FPR_BOX(source1));
+#undef fpr_rs1
+#undef fpr_rs2
+#undef fpr_rs3
+#undef fpr_rd
+#undef rm
+#endif
+
 	INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak, N, NEMUTRAP(s->pc, gpr(10))); // R(10) is $a0
 	INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv, N, INV(s->pc));
 	INSTPAT_END();
@@ -209,12 +375,52 @@ static int decode_exec(Decode *s)
 	return 0;
 }
 
+#ifdef CONFIG_PERF
+// the class of an instruction is decided by its major opcode, i.e. inst[6:2],
+// and the opcodes not listed are invalid, which abort NEMU
+static const uint8_t opcode_class[32] = {
+	[0x00] = PERF_LOAD, [0x01] = PERF_LOAD, [0x03] = PERF_SYSTEM, [0x04] = PERF_ALU, [0x05] = PERF_ALU,
+	[0x08] = PERF_STORE, [0x09] = PERF_STORE, [0x0b] = PERF_AMO, [0x0c] = PERF_ALU, [0x0d] = PERF_ALU,
+	[0x10] = PERF_FPU, [0x11] = PERF_FPU, [0x12] = PERF_FPU, [0x13] = PERF_FPU, [0x14] = PERF_FPU,
+	[0x18] = PERF_BRANCH, [0x19] = PERF_JUMP, [0x1b] = PERF_JUMP, [0x1c] = PERF_SYSTEM,
+};
+
+static void perf_classify(Decode *s)
+{
+	uint32_t i = s->isa.expanded;
+	int c = opcode_class[BITS(i, 6, 2)];
+	if (c == PERF_ALU && BITS(i, 6, 2) == 0x0c && BITS(i, 31, 25) == 1)
+		c = PERF_MULDIV;
+	else if (c == PERF_SYSTEM && BITS(i, 6, 2) == 0x1c && BITS(i, 14, 12) != 0)
+		c = PERF_CSR;
+	else if (c == PERF_BRANCH && s->dnpc != s->snpc)
+		perf_inc(PERF_BRANCH_TAKEN);
+	perf_inc(c);
+}
+#endif
+
 int isa_exec_once(Decode *s)
 {
-	s->isa.inst.val = inst_fetch(&s->snpc, 4);
+	// fetch 4 bytes at once, and step back if the instruction is compressed
+	uint32_t inst = (likely(in_pmem(s->pc + 3)) ? inst_fetch(&s->snpc, 4) : inst_fetch(&s->snpc, 2));
+	if (BITS(inst, 1, 0) != 3)
+	{
+		s->snpc = s->pc + 2;
+		s->isa.inst.val = inst & 0xffff;
+		s->isa.expanded = rvc_expand(inst);
+	}
+	else
+	{
+		if (unlikely(s->snpc - s->pc == 2))
+		{
+			inst |= inst_fetch(&s->snpc, 2) << 16;
+		}
+		s->isa.inst.val = s->isa.expanded = inst;
+	}
 	if (s->pc == 0x830000e8)
 		decode_exec(s);
 	else
 		decode_exec(s);
+	IFDEF(CONFIG_PERF, perf_classify(s));
 	return 0;
 }
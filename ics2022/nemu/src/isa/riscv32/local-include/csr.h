@@ -0,0 +1,82 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __RISCV32_CSR_H__
+#define __RISCV32_CSR_H__
+
+#include <common.h>
+
+enum { PRV_U = 0, PRV_S = 1, PRV_M = 3 };
+
+enum {
+  CSR_FFLAGS = 0x001, CSR_FRM = 0x002, CSR_FCSR = 0x003,
+
+  CSR_SSTATUS = 0x100, CSR_SIE = 0x104, CSR_STVEC = 0x105, CSR_SCOUNTEREN = 0x106,
+  CSR_SSCRATCH = 0x140, CSR_SEPC = 0x141, CSR_SCAUSE = 0x142, CSR_STVAL = 0x143, CSR_SIP = 0x144,
+  CSR_SATP = 0x180,
+
+  CSR_MSTATUS = 0x300, CSR_MISA = 0x301, CSR_MEDELEG = 0x302, CSR_MIDELEG = 0x303,
+  CSR_MIE = 0x304, CSR_MTVEC = 0x305, CSR_MCOUNTEREN = 0x306, CSR_MHPMEVENT3 = 0x323,
+  CSR_MSCRATCH = 0x340, CSR_MEPC = 0x341, CSR_MCAUSE = 0x342, CSR_MTVAL = 0x343, CSR_MIP = 0x344,
+
+  // counter i is at base + i, and its high half is at base + 0x80 + i
+  CSR_MCYCLE = 0xb00, CSR_MINSTRET = 0xb02, CSR_MCYCLEH = 0xb80, CSR_MINSTRETH = 0xb82,
+  CSR_CYCLE = 0xc00, CSR_INSTRET = 0xc02, CSR_CYCLEH = 0xc80, CSR_INSTRETH = 0xc82,
+
+  CSR_MVENDORID = 0xf11, CSR_MARCHID = 0xf12, CSR_MIMPID = 0xf13, CSR_MHARTID = 0xf14,
+};
+
+/* The enable bit, the previous enable bit and the previous privilege
+ * of mode `m` in mstatus, so that traps to S-mode and M-mode share the
+ * same code. SPP has only one bit, which is enough for U and S. */
+#define MSTATUS_IE(m)   (1u << (m))
+#define MSTATUS_PIE(m)  (1u << (4 + (m)))
+#define MSTATUS_PP_SHIFT(m) ((m) == PRV_M ? 11 : 8)
+#define MSTATUS_PP(m)   ((m) == PRV_M ? 3u << 11 : 1u << 8)
+
+#define MSTATUS_SIE  MSTATUS_IE(PRV_S)
+#define MSTATUS_MIE  MSTATUS_IE(PRV_M)
+#define MSTATUS_SPIE MSTATUS_PIE(PRV_S)
+#define MSTATUS_MPIE MSTATUS_PIE(PRV_M)
+#define MSTATUS_SPP  MSTATUS_PP(PRV_S)
+#define MSTATUS_MPP  MSTATUS_PP(PRV_M)
+#define MSTATUS_MPRV (1u << 17)
+#define MSTATUS_SUM  (1u << 18)
+#define MSTATUS_MXR  (1u << 19)
+#define MSTATUS_TSR  (1u << 22)
+#define MSTATUS_FS   (3u << 13) // Off (0), Initial (1), Clean (2) or Dirty (3)
+#define MSTATUS_SD   (1u << 31) // FS is Dirty
+#define MSTATUS_FS_INITIAL (1u << 13)
+
+// the FP state is modified
+#define FS_SET_DIRTY() (cpu.mstatus |= MSTATUS_FS | MSTATUS_SD)
+
+#define INTR_BIT (1u << 31)
+
+// exception codes
+enum { EX_II = 2, EX_BP = 3, EX_LAM = 4, EX_SAM = 6, EX_ECU = 8, EX_ECS = 9, EX_ECM = 11 };
+
+void init_csr();
+
+/* Accesses of `csr` from the current privilege mode. They return false
+ * if the access is illegal, i.e. the CSR does not exist, is more
+ * privileged than the hart, or is read-only for a write. */
+bool csr_read(int csr, word_t *val);
+bool csr_write(int csr, word_t val);
+
+/* mret (mode = PRV_M) and sret (mode = PRV_S), return the new pc */
+vaddr_t trap_return(int mode);
+
+#endif
@@ -0,0 +1,48 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __RISCV32_FPU_H__
+#define __RISCV32_FPU_H__
+
+#include <common.h>
+
+/* Registers hold the raw bits of the values, and single-precision values
+ * are NaN-boxed. All the operations below accrue exceptions to fflags.
+ * `rm` is the rounding mode in the instruction, 7 means using frm. */
+
+enum { FP_S, FP_D };
+enum {
+  FPU_ADD, FPU_SUB, FPU_MUL, FPU_DIV, FPU_SQRT, FPU_MIN, FPU_MAX,
+  FPU_MADD, FPU_MSUB, FPU_NMSUB, FPU_NMADD,
+  FPU_SGNJ, FPU_SGNJN, FPU_SGNJX,
+  FPU_EQ, FPU_LT, FPU_LE,
+};
+
+#define FPR_BOX(x) ((uint64_t)(uint32_t)(x) | 0xffffffff00000000ull)
+
+uint64_t fpu_arith(int op, int fmt, uint64_t a, uint64_t b, uint64_t c, int rm);
+word_t fpu_cmp(int op, int fmt, uint64_t a, uint64_t b);
+word_t fpu_class(int fmt, uint64_t a);
+word_t fpu_to_int(int fmt, uint64_t a, bool is_signed, int rm);
+uint64_t fpu_from_int(int fmt, word_t x, bool is_signed, int rm);
+uint64_t fpu_cvt(int to_fmt, uint64_t a, int rm);
+/* whether `rm` is a valid rounding mode, i.e. not a reserved one, also when it selects frm */
+bool fpu_rm_valid(int rm);
+
+/* fflags (1), frm (2) and fcsr (3) are all views of fcsr */
+word_t fpu_csr_read(int csr);
+void fpu_csr_write(int csr, word_t val);
+
+#endif
@@ -0,0 +1,29 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __RISCV32_RVC_H__
+#define __RISCV32_RVC_H__
+
+#include <common.h>
+
+void init_rvc();
+
+/* the 32-bit form of a compressed instruction, 0 if it is illegal */
+static inline uint32_t rvc_expand(uint16_t inst) {
+  extern uint32_t rvc_table[];
+  return rvc_table[inst];
+}
+
+#endif
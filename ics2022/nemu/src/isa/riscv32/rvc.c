@@ -0,0 +1,188 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Compressed instructions (RV32C) are expanded to their 32-bit forms and
+ * executed by decode_exec() as usual. The expansion only depends on the
+ * 16-bit encoding, so the 32-bit forms of all encodings are computed once
+ * at initialization, and expanding an instruction is a table lookup.
+ */
+
+#include <common.h>
+#include "local-include/rvc.h"
+
+#define OP_LOAD     0x03
+#define OP_LOAD_FP  0x07
+#define OP_IMM      0x13
+#define OP_STORE    0x23
+#define OP_STORE_FP 0x27
+#define OP_REG      0x33
+#define OP_LUI      0x37
+#define OP_BRANCH   0x63
+#define OP_JALR     0x67
+#define OP_JAL      0x6f
+
+#define EBREAK      0x00100073
+#define ILLEGAL     0  // not decoded by decode_exec(), thus an invalid instruction
+
+static inline uint32_t enc_r(uint32_t funct7, uint32_t rs2, uint32_t rs1, uint32_t funct3, uint32_t rd, uint32_t opcode) {
+  return (funct7 << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
+}
+
+static inline uint32_t enc_i(uint32_t imm, uint32_t rs1, uint32_t funct3, uint32_t rd, uint32_t opcode) {
+  return ((imm & 0xfff) << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
+}
+
+static inline uint32_t enc_s(uint32_t imm, uint32_t rs2, uint32_t rs1, uint32_t funct3, uint32_t opcode) {
+  return (BITS(imm, 11, 5) << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) |
+    (BITS(imm, 4, 0) << 7) | opcode;
+}
+
+static inline uint32_t enc_b(uint32_t imm, uint32_t rs2, uint32_t rs1, uint32_t funct3) {
+  return (BITS(imm, 12, 12) << 31) | (BITS(imm, 10, 5) << 25) | (rs2 << 20) | (rs1 << 15) |
+    (funct3 << 12) | (BITS(imm, 4, 1) << 8) | (BITS(imm, 11, 11) << 7) | OP_BRANCH;
+}
+
+static inline uint32_t enc_j(uint32_t imm, uint32_t rd) {
+  return (BITS(imm, 20, 20) << 31) | (BITS(imm, 10, 1) << 21) | (BITS(imm, 11, 11) << 20) |
+    (BITS(imm, 19, 12) << 12) | (rd << 7) | OP_JAL;
+}
+
+// registers x8-x15 encoded in 3 bits
+#define RC(hi, lo) (8 + BITS(c, hi, lo))
+// funct3 and opcode of a compressed instruction
+#define Q(funct3, op) (((funct3) << 2) | (op))
+
+static uint32_t expand(uint32_t c) {
+  uint32_t rd = BITS(c, 11, 7), rs2 = BITS(c, 6, 2);
+  int32_t imm6 = SEXT((BITS(c, 12, 12) << 5) | BITS(c, 6, 2), 6);
+  int32_t imm;
+
+  switch (Q(BITS(c, 15, 13), BITS(c, 1, 0))) {
+    // quadrant 0
+    case Q(0, 0): // c.addi4spn
+      imm = (BITS(c, 12, 11) << 4) | (BITS(c, 10, 7) << 6) | (BITS(c, 6, 6) << 2) | (BITS(c, 5, 5) << 3);
+      return (imm == 0 ? ILLEGAL : enc_i(imm, 2, 0, RC(4, 2), OP_IMM));
+    case Q(2, 0): // c.lw
+      imm = (BITS(c, 12, 10) << 3) | (BITS(c, 6, 6) << 2) | (BITS(c, 5, 5) << 6);
+      return enc_i(imm, RC(9, 7), 2, RC(4, 2), OP_LOAD);
+    case Q(6, 0): // c.sw
+      imm = (BITS(c, 12, 10) << 3) | (BITS(c, 6, 6) << 2) | (BITS(c, 5, 5) << 6);
+      return enc_s(imm, RC(4, 2), RC(9, 7), 2, OP_STORE);
+#ifdef CONFIG_FPU
+    case Q(1, 0): // c.fld
+      imm = (BITS(c, 12, 10) << 3) | (BITS(c, 6, 5) << 6);
+      return enc_i(imm, RC(9, 7), 3, RC(4, 2), OP_LOAD_FP);
+    case Q(3, 0): // c.flw
+      imm = (BITS(c, 12, 10) << 3) | (BITS(c, 6, 6) << 2) | (BITS(c, 5, 5) << 6);
+      return enc_i(imm, RC(9, 7), 2, RC(4, 2), OP_LOAD_FP);
+    case Q(5, 0): // c.fsd
+      imm = (BITS(c, 12, 10) << 3) | (BITS(c, 6, 5) << 6);
+      return enc_s(imm, RC(4, 2), RC(9, 7), 3, OP_STORE_FP);
+    case Q(7, 0): // c.fsw
+      imm = (BITS(c, 12, 10) << 3) | (BITS(c, 6, 6) << 2) | (BITS(c, 5, 5) << 6);
+      return enc_s(imm, RC(4, 2), RC(9, 7), 2, OP_STORE_FP);
+#endif
+
+    // quadrant 1
+    case Q(0, 1): // c.addi, c.nop
+      return enc_i(imm6, rd, 0, rd, OP_IMM);
+    case Q(1, 1): // c.jal
+    case Q(5, 1): // c.j
+      imm = SEXT((BITS(c, 12, 12) << 11) | (BITS(c, 11, 11) << 4) | (BITS(c, 10, 9) << 8) |
+          (BITS(c, 8, 8) << 10) | (BITS(c, 7, 7) << 6) | (BITS(c, 6, 6) << 7) |
+          (BITS(c, 5, 3) << 1) | (BITS(c, 2, 2) << 5), 12);
+      return enc_j(imm, (BITS(c, 15, 13) == 1 ? 1 : 0));
+    case Q(2, 1): // c.li
+      return enc_i(imm6, 0, 0, rd, OP_IMM);
+    case Q(3, 1):
+      if (rd == 2) { // c.addi16sp
+        imm = SEXT((BITS(c, 12, 12) << 9) | (BITS(c, 6, 6) << 4) | (BITS(c, 5, 5) << 6) |
+            (BITS(c, 4, 3) << 7) | (BITS(c, 2, 2) << 5), 10);
+        return (imm == 0 ? ILLEGAL : enc_i(imm, 2, 0, 2, OP_IMM));
+      }
+      // c.lui
+      return (imm6 == 0 ? ILLEGAL : ((uint32_t)imm6 << 12) | (rd << 7) | OP_LUI);
+    case Q(4, 1): {
+      uint32_t r = RC(9, 7);
+      switch (BITS(c, 11, 10)) {
+        case 0: // c.srli, shamt[5] must be 0 for RV32C
+          return (BITS(c, 12, 12) ? ILLEGAL : enc_i(BITS(c, 6, 2), r, 5, r, OP_IMM));
+        case 1: // c.srai
+          return (BITS(c, 12, 12) ? ILLEGAL : enc_i(0x400 | BITS(c, 6, 2), r, 5, r, OP_IMM));
+        case 2: // c.andi
+          return enc_i(imm6, r, 7, r, OP_IMM);
+      }
+      if (BITS(c, 12, 12)) return ILLEGAL;
+      switch (BITS(c, 6, 5)) {
+        case 0: return enc_r(0x20, RC(4, 2), r, 0, r, OP_REG); // c.sub
+        case 1: return enc_r(0x00, RC(4, 2), r, 4, r, OP_REG); // c.xor
+        case 2: return enc_r(0x00, RC(4, 2), r, 6, r, OP_REG); // c.or
+        default: return enc_r(0x00, RC(4, 2), r, 7, r, OP_REG); // c.and
+      }
+    }
+    case Q(6, 1): // c.beqz
+    case Q(7, 1): // c.bnez
+      imm = SEXT((BITS(c, 12, 12) << 8) | (BITS(c, 11, 10) << 3) | (BITS(c, 6, 5) << 6) |
+          (BITS(c, 4, 3) << 1) | (BITS(c, 2, 2) << 5), 9);
+      return enc_b(imm, 0, RC(9, 7), (BITS(c, 15, 13) == 6 ? 0 : 1));
+
+    // quadrant 2
+    case Q(0, 2): // c.slli, shamt[5] must be 0 for RV32C
+      return (BITS(c, 12, 12) ? ILLEGAL : enc_i(BITS(c, 6, 2), rd, 1, rd, OP_IMM));
+    case Q(2, 2): // c.lwsp
+      imm = (BITS(c, 12, 12) << 5) | (BITS(c, 6, 4) << 2) | (BITS(c, 3, 2) << 6);
+      return (rd == 0 ? ILLEGAL : enc_i(imm, 2, 2, rd, OP_LOAD));
+    case Q(4, 2):
+      if (BITS(c, 12, 12) == 0) {
+        if (rs2 == 0) return (rd == 0 ? ILLEGAL : enc_i(0, rd, 0, 0, OP_JALR)); // c.jr
+        return enc_r(0, rs2, 0, 0, rd, OP_REG); // c.mv
+      }
+      if (rs2 == 0) return (rd == 0 ? EBREAK : enc_i(0, rd, 0, 1, OP_JALR)); // c.ebreak, c.jalr
+      return enc_r(0, rs2, rd, 0, rd, OP_REG); // c.add
+    case Q(6, 2): // c.swsp
+      imm = (BITS(c, 12, 9) << 2) | (BITS(c, 8, 7) << 6);
+      return enc_s(imm, rs2, 2, 2, OP_STORE);
+#ifdef CONFIG_FPU
+    // unlike c.lwsp, f0 is a valid destination of c.flwsp and c.fldsp
+    case Q(1, 2): // c.fldsp
+      imm = (BITS(c, 12, 12) << 5) | (BITS(c, 6, 5) << 3) | (BITS(c, 4, 2) << 6);
+      return enc_i(imm, 2, 3, rd, OP_LOAD_FP);
+    case Q(3, 2): // c.flwsp
+      imm = (BITS(c, 12, 12) << 5) | (BITS(c, 6, 4) << 2) | (BITS(c, 3, 2) << 6);
+      return enc_i(imm, 2, 2, rd, OP_LOAD_FP);
+    case Q(5, 2): // c.fsdsp
+      imm = (BITS(c, 12, 10) << 3) | (BITS(c, 9, 7) << 6);
+      return enc_s(imm, rs2, 2, 3, OP_STORE_FP);
+    case Q(7, 2): // c.fswsp
+      imm = (BITS(c, 12, 9) << 2) | (BITS(c, 8, 7) << 6);
+      return enc_s(imm, rs2, 2, 2, OP_STORE_FP);
+#endif
+
+    default: return ILLEGAL;
+  }
+}
+
+uint32_t rvc_table[1 << 16] = {};
+
+void init_rvc() {
+  // the table is shared by all instances
+  static bool ready = false;
+  if (ready) return;
+  ready = true;
+  uint32_t c;
+  for (c = 0; c < ARRLEN(rvc_table); c ++) {
+    rvc_table[c] = (BITS(c, 1, 0) == 3 ? ILLEGAL : expand(c));
+  }
+}
@@ -0,0 +1,213 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* The CSR file. Every CSR is described by an entry of the table below,
+ * which is indexed by the CSR number through csr_idx[]. Most CSRs are
+ * backed by a field of the CPU state and accessed through their read and
+ * write masks, while the others have hooks for views and side effects.
+ * The privilege and read-only checks come from the CSR number itself.
+ */
+
+#include <isa.h>
+#include <stddef.h>
+#include <cpu/difftest.h>
+#include "../local-include/csr.h"
+#include "../local-include/fpu.h"
+
+typedef struct {
+  uint16_t num;
+  uint16_t off;    // offset of the backing field in the CPU state
+  word_t rmask;    // bits which are not readable read as 0
+  word_t wmask;    // bits which are not writable keep their values
+  word_t (*read)(int num);            // if not NULL, replaces the default read
+  void (*write)(int num, word_t val); // if not NULL, replaces the default write
+  int nr;          // number of consecutive CSRs described by the entry, 0 means 1
+} CSR;
+
+#define FIELD(f) offsetof(riscv32_CPU_state, f)
+
+// FS is read-only 0 without the FPU
+#define MSTATUS_FS_MASK MUXDEF(CONFIG_FPU, MSTATUS_FS, 0)
+#define MSTATUS_WMASK (MSTATUS_SIE | MSTATUS_MIE | MSTATUS_SPIE | MSTATUS_MPIE | \
+    MSTATUS_SPP | MSTATUS_MPP | MSTATUS_MPRV | MSTATUS_SUM | MSTATUS_MXR | MSTATUS_TSR | MSTATUS_FS_MASK)
+#define SSTATUS_MASK  (MSTATUS_SIE | MSTATUS_SPIE | MSTATUS_SPP | MSTATUS_SUM | MSTATUS_MXR | MSTATUS_FS_MASK)
+#define MIP_MASK      0x222  // SSIP, STIP and SEIP
+#define MIE_MASK      0xaaa  // SxIE and MxIE
+#define MEDELEG_MASK  0xb3ff // all exceptions except ecall from M-mode
+
+#define MISA ((1u << 30) | (1 << ('A' - 'A')) | (1 << ('C' - 'A')) | (1 << ('I' - 'A')) | \
+    (1 << ('M' - 'A')) | (1 << ('S' - 'A')) | (1 << ('U' - 'A')) | \
+    MUXDEF(CONFIG_FPU, (1 << ('F' - 'A')) | (1 << ('D' - 'A')), 0))
+
+static word_t misa_read(int num) { return MISA; }
+static word_t zero_read(int num) { return 0; }
+
+// sstatus is a view of mstatus
+static void mstatus_write(int num, word_t val) {
+  word_t mask = (num == CSR_SSTATUS ? SSTATUS_MASK : MSTATUS_WMASK);
+  cpu.mstatus = (cpu.mstatus & ~mask) | (val & mask);
+  // MPP is WARL, and H-mode is not supported
+  if ((cpu.mstatus & MSTATUS_MPP) == (2u << 11)) cpu.mstatus &= ~MSTATUS_MPP;
+  cpu.mstatus = (cpu.mstatus & ~MSTATUS_SD) | ((cpu.mstatus & MSTATUS_FS) == MSTATUS_FS ? MSTATUS_SD : 0);
+}
+
+// sie and sip only show the interrupts delegated to S-mode
+static word_t sie_read(int num) {
+  return (num == CSR_SIE ? cpu.mie : cpu.mip) & cpu.mideleg;
+}
+
+static void sie_write(int num, word_t val) {
+  word_t *p = (num == CSR_SIE ? &cpu.mie : &cpu.mip);
+  // only SSIP is writable in sip
+  word_t mask = cpu.mideleg & (num == CSR_SIE ? MIE_MASK : 0x2);
+  *p = (*p & ~mask) | (val & mask);
+}
+
+/* Counter i, i.e. mcycle (0), minstret (2) or mhpmcounter3-31, counts the
+ * events selected for it minus its base, so that a write only moves the
+ * base. */
+static uint64_t counter_events(int i) {
+  return (i == 0 ? g_nr_guest_cycle : i == 2 ? g_nr_guest_inst : perf_count(cpu.mhpmevent[i]));
+}
+
+static uint64_t counter_get(int i) {
+  return counter_events(i) - cpu.counter_base[i];
+}
+
+static void counter_set(int i, uint64_t val) {
+  // the writing instruction itself is not counted by mcycle and minstret
+  cpu.counter_base[i] = counter_events(i) + (i <= 2) - val;
+}
+
+static word_t counter_read(int num) {
+  // the reference design counts in its own way
+  difftest_skip_ref();
+  uint64_t v = counter_get(num & 0x1f);
+  return (num & 0x80 ? v >> 32 : (word_t)v);
+}
+
+static void counter_write(int num, word_t val) {
+  int i = num & 0x1f;
+  uint64_t v = counter_get(i);
+  counter_set(i, (num & 0x80 ? (uint32_t)v | ((uint64_t)val << 32) : (v & ~0xffffffffull) | val));
+}
+
+static word_t mhpmevent_read(int num) { return cpu.mhpmevent[num & 0x1f]; }
+
+// the counter keeps its value when another event is selected
+static void mhpmevent_write(int num, word_t val) {
+  int i = num & 0x1f;
+  uint64_t v = counter_get(i);
+  cpu.mhpmevent[i] = val;
+  counter_set(i, v);
+}
+
+// U-mode counters are enabled by mcounteren below M-mode, and also by scounteren in U-mode
+static inline bool counter_enabled(int i) {
+  return (cpu.priv == PRV_M || ((cpu.mcounteren >> i) & 1)) &&
+    (cpu.priv != PRV_U || ((cpu.scounteren >> i) & 1));
+}
+
+#define COUNTER(num, nr) { num, 0, 0, 0, counter_read, counter_write, nr }
+
+static const CSR csr_table[] = {
+  { 0 }, // index 0 means the CSR does not exist
+#ifdef CONFIG_FPU
+  { CSR_FFLAGS, 0, 0, 0, fpu_csr_read, fpu_csr_write },
+  { CSR_FRM, 0, 0, 0, fpu_csr_read, fpu_csr_write },
+  { CSR_FCSR, 0, 0, 0, fpu_csr_read, fpu_csr_write },
+#endif
+  { CSR_SSTATUS,  FIELD(mstatus), SSTATUS_MASK | MSTATUS_SD, 0, NULL, mstatus_write },
+  { CSR_SIE,      0, 0, 0, sie_read, sie_write },
+  { CSR_STVEC,    FIELD(trap[PRV_S].tvec), -1, ~(word_t)2 },
+  { CSR_SCOUNTEREN, FIELD(scounteren), -1, -1 },
+  { CSR_SSCRATCH, FIELD(trap[PRV_S].scratch), -1, -1 },
+  { CSR_SEPC,     FIELD(trap[PRV_S].epc), -1, ~(word_t)1 },
+  { CSR_SCAUSE,   FIELD(trap[PRV_S].cause), -1, -1 },
+  { CSR_STVAL,    FIELD(trap[PRV_S].tval), -1, -1 },
+  { CSR_SIP,      0, 0, 0, sie_read, sie_write },
+  { CSR_SATP,     FIELD(satp), -1, -1 },
+  { CSR_MSTATUS,  FIELD(mstatus), -1, MSTATUS_WMASK, NULL, mstatus_write },
+  { CSR_MISA,     0, 0, 0, misa_read }, // writes are ignored
+  { CSR_MEDELEG,  FIELD(medeleg), -1, MEDELEG_MASK },
+  { CSR_MIDELEG,  FIELD(mideleg), -1, MIP_MASK },
+  { CSR_MIE,      FIELD(mie), -1, MIE_MASK },
+  { CSR_MTVEC,    FIELD(trap[PRV_M].tvec), -1, ~(word_t)2 },
+  { CSR_MCOUNTEREN, FIELD(mcounteren), -1, -1 },
+  { CSR_MHPMEVENT3, 0, 0, 0, mhpmevent_read, mhpmevent_write, 29 },
+  { CSR_MSCRATCH, FIELD(trap[PRV_M].scratch), -1, -1 },
+  { CSR_MEPC,     FIELD(trap[PRV_M].epc), -1, ~(word_t)1 },
+  { CSR_MCAUSE,   FIELD(trap[PRV_M].cause), -1, -1 },
+  { CSR_MTVAL,    FIELD(trap[PRV_M].tval), -1, -1 },
+  { CSR_MIP,      FIELD(mip), -1, MIP_MASK },
+  { CSR_MVENDORID, 0, 0, 0, zero_read },
+  { CSR_MARCHID,  0, 0, 0, zero_read },
+  { CSR_MIMPID,   0, 0, 0, zero_read },
+  { CSR_MHARTID,  FIELD(mhartid), -1, 0 },
+  // the U-mode counters are read-only views of the M-mode ones
+  COUNTER(CSR_MCYCLE, 1), COUNTER(CSR_MINSTRET, 30), COUNTER(CSR_MCYCLEH, 1), COUNTER(CSR_MINSTRETH, 30),
+  COUNTER(CSR_CYCLE, 1),  COUNTER(CSR_INSTRET, 30),  COUNTER(CSR_CYCLEH, 1),  COUNTER(CSR_INSTRETH, 30),
+};
+
+static uint8_t csr_idx[4096] = {};
+
+void init_csr() {
+  // the index is shared by all instances
+  static bool ready = false;
+  if (ready) return;
+  ready = true;
+  int i;
+  for (i = 1; i < ARRLEN(csr_table); i ++) {
+    int j, nr = (csr_table[i].nr ? csr_table[i].nr : 1);
+    for (j = 0; j < nr; j ++) csr_idx[csr_table[i].num + j] = i;
+  }
+}
+
+static inline word_t *csr_field(const CSR *c) {
+  return (word_t *)((uint8_t *)&cpu + c->off);
+}
+
+// csr[9:8] is the lowest privilege mode allowed to access the CSR
+static inline const CSR *csr_lookup(int csr) {
+  int i = csr_idx[csr];
+  if (unlikely(i == 0) || cpu.priv < BITS(csr, 9, 8)) return NULL;
+  // fflags, frm and fcsr are not accessible when the FPU is off
+  if (csr <= CSR_FCSR && (cpu.mstatus & MSTATUS_FS) == 0) return NULL;
+  // cycle, instret and hpmcounter3-31 with their high halves
+  if ((csr & 0xf60) == CSR_CYCLE && !counter_enabled(csr & 0x1f)) return NULL;
+  return &csr_table[i];
+}
+
+bool csr_read(int csr, word_t *val) {
+  csr &= 0xfff;
+  const CSR *c = csr_lookup(csr);
+  if (unlikely(c == NULL)) return false;
+  *val = (c->read ? c->read(csr) : *csr_field(c) & c->rmask);
+  return true;
+}
+
+// csr[11:10] = 3 means the CSR is read-only
+bool csr_write(int csr, word_t val) {
+  csr &= 0xfff;
+  const CSR *c = csr_lookup(csr);
+  if (unlikely(c == NULL || BITS(csr, 11, 10) == 3)) return false;
+  if (c->write) c->write(csr, val);
+  else if (!c->read) {
+    word_t *p = csr_field(c);
+    *p = (*p & ~c->wmask) | (val & c->wmask);
+  }
+  if (csr <= CSR_FCSR) FS_SET_DIRTY();
+  return true;
+}
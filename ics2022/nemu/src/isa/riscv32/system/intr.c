@@ -12,14 +12,45 @@
 *
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
-
 #include <isa.h>
+#include "../local-include/csr.h"
+
+/* Traps go to M-mode unless they are delegated to S-mode, which is only
+ * allowed for traps taken in S-mode or U-mode. The CSRs and the mstatus
+ * bits of the target mode are indexed by the mode, so that both modes
+ * are handled by the same code. */
+vaddr_t isa_raise_intr(word_t NO, vaddr_t epc) {
+  word_t code = NO & ~INTR_BIT;
+  perf_trap(NO & INTR_BIT, code);
+  word_t deleg = ((NO & INTR_BIT) ? cpu.mideleg : cpu.medeleg);
+  int m = (cpu.priv <= PRV_S && ((deleg >> code) & 1) ? PRV_S : PRV_M);
+  riscv32_TrapCSR *t = &cpu.trap[m];
+  t->epc = epc;
+  t->cause = NO;
+  t->tval = 0;
 
-word_t isa_raise_intr(word_t NO, vaddr_t epc) {
-  cpu.mepc = epc;
-	cpu.mcause = NO;
+  // xPIE = xIE, xIE = 0, xPP = priv
+  word_t s = cpu.mstatus;
+  word_t ie = (s >> m) & 1;
+  cpu.mstatus = (s & ~(MSTATUS_IE(m) | MSTATUS_PIE(m) | MSTATUS_PP(m))) |
+    (ie << (4 + m)) | ((word_t)cpu.priv << MSTATUS_PP_SHIFT(m));
+  cpu.priv = m;
+
+  // interrupts jump to base + 4 * code in the vectored mode
+  bool vectored = (t->tvec & 1) && (NO & INTR_BIT);
+  return (t->tvec & ~(word_t)3) + (vectored ? 4 * code : 0);
+}
 
-  return cpu.mtvec;
+vaddr_t trap_return(int m) {
+  // xIE = xPIE, xPIE = 1, priv = xPP, xPP = U
+  word_t s = cpu.mstatus;
+  int pp = (s & MSTATUS_PP(m)) >> MSTATUS_PP_SHIFT(m);
+  word_t pie = (s >> (4 + m)) & 1;
+  s = (s & ~(MSTATUS_IE(m) | MSTATUS_PP(m))) | (pie << m) | MSTATUS_PIE(m);
+  // MPRV is cleared when returning to a mode less privileged than M-mode
+  cpu.mstatus = s & ~(pp != PRV_M ? MSTATUS_MPRV : 0);
+  cpu.priv = pp;
+  return cpu.trap[m].epc;
 }
 
 word_t isa_query_intr() {
@@ -21,6 +21,12 @@
 typedef struct {
   word_t gpr[32];
   vaddr_t pc;
+  word_t mstatus, mtvec, mscratch, mepc, mcause;
+  word_t mhartid;
+  // reservation set by lr, private to the hart
+  vaddr_t lr_addr;
+  word_t lr_data;
+  bool lr_valid;
 } riscv64_CPU_state;
 
 // decode
@@ -15,6 +15,8 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include <cpu/cpu.h>
+#include "local-include/csr.h"
 
 // this is not consistent with uint8_t
 // but it is ok since we do not access the array directly
@@ -26,12 +28,23 @@ static const uint32_t img [] = {
   0xdeadbeef,  // some data
 };
 
-static void restart() {
+static void restart(int hartid) {
   /* Set the initial program counter. */
   cpu.pc = RESET_VECTOR;
 
   /* The zero register is always 0. */
   cpu.gpr[0] = 0;
+
+  cpu.mhartid = hartid;
+  cpu.mstatus = MSTATUS_MPP;
+
+  /* Pass the hart ID and the number of harts to the guest in a0/a1. */
+  cpu.gpr[10] = hartid;
+  cpu.gpr[11] = NR_HART;
+}
+
+void init_isa_hart(int hartid) {
+  restart(hartid);
 }
 
 void init_isa() {
@@ -39,5 +52,5 @@ void init_isa() {
   memcpy(guest_to_host(RESET_VECTOR), img, sizeof(img));
 
   /* Initialize this virtual computer system. */
-  restart();
+  restart(0);
 }
@@ -14,16 +14,20 @@
 ***************************************************************************************/
 
 #include "local-include/reg.h"
+#include "local-include/csr.h"
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <cpu/muldiv.h>
+#include <memory/paddr.h>
 
 #define R(i) gpr(i)
 #define Mr vaddr_read
 #define Mw vaddr_write
+#define Ma vaddr_amo
 
 enum {
-  TYPE_I, TYPE_U, TYPE_S,
+  TYPE_R, TYPE_I, TYPE_U, TYPE_S, TYPE_B, TYPE_J,
   TYPE_N, // none
 };
 
@@ -32,6 +36,10 @@ enum {
 #define immI() do { *imm = SEXT(BITS(i, 31, 20), 12); } while(0)
 #define immU() do { *imm = SEXT(BITS(i, 31, 12), 20) << 12; } while(0)
 #define immS() do { *imm = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7); } while(0)
+#define immB() do { *imm = (SEXT(BITS(i, 31, 31), 1) << 12) | (BITS(i, 7, 7) << 11) | \
+                          (BITS(i, 30, 25) << 5) | (BITS(i, 11, 8) << 1); } while(0)
+#define immJ() do { *imm = (SEXT(BITS(i, 31, 31), 1) << 20) | (BITS(i, 19, 12) << 12) | \
+                          (BITS(i, 20, 20) << 11) | (BITS(i, 30, 21) << 1); } while(0)
 
 static void decode_operand(Decode *s, int *dest, word_t *src1, word_t *src2, word_t *imm, int type) {
   uint32_t i = s->isa.inst.val;
@@ -40,16 +48,64 @@ static void decode_operand(Decode *s, int *dest, word_t *src1, word_t *src2, wor
   int rs2 = BITS(i, 24, 20);
   *dest = rd;
   switch (type) {
+    case TYPE_R: src1R(); src2R();         break;
     case TYPE_I: src1R();          immI(); break;
     case TYPE_U:                   immU(); break;
     case TYPE_S: src1R(); src2R(); immS(); break;
+    case TYPE_B: src1R(); src2R(); immB(); break;
+    case TYPE_J:                   immJ(); break;
   }
 }
 
+// sc succeeds only if the data at the reserved address is not changed since lr
+static word_t lr(vaddr_t addr, int len) {
+  cpu.lr_addr = addr;
+  cpu.lr_data = Mr(addr, len);
+  cpu.lr_valid = true;
+  return cpu.lr_data;
+}
+
+static word_t sc(vaddr_t addr, int len, word_t data) {
+  bool ok = cpu.lr_valid && cpu.lr_addr == addr && vaddr_cas(addr, len, cpu.lr_data, data);
+  cpu.lr_valid = false;
+  return !ok;
+}
+
+enum { CSR_RW, CSR_RS, CSR_RC };
+
+/* csrrs and csrrc do not write the CSR if rs1 (or uimm) is x0, and csrrw
+ * does not read it if rd is x0. Illegal accesses are invalid instructions. */
+static void csr_access(Decode *s, int rd, word_t imm, int op, word_t src) {
+  int csr = imm & 0xfff;
+  word_t old = 0;
+  bool ok = (op == CSR_RW && rd == 0) || csr_read(csr, &old);
+  if (ok && (op == CSR_RW || BITS(s->isa.inst.val, 19, 15) != 0)) {
+    ok = csr_write(csr, op == CSR_RW ? src : op == CSR_RS ? old | src : old & ~src);
+  }
+  if (unlikely(!ok)) {
+    INV(s->pc);
+    return;
+  }
+  R(rd) = old;
+}
+
+/* LR, SC and AMOs need naturally aligned addresses, otherwise they raise a
+ * load (LR) or store/AMO address misaligned exception. mtval is not
+ * implemented. Return false if the exception is raised. */
+static bool amo_check(Decode *s) {
+  uint32_t i = s->isa.inst.val;
+  int width = BITS(i, 14, 12);
+  if (BITS(i, 6, 0) != 0x2f || (width != 2 && width != 3)) return true;
+  if ((R(BITS(i, 19, 15)) & ((1 << width) - 1)) == 0) return true;
+  s->dnpc = isa_raise_intr(BITS(i, 31, 27) == 0x02 ? EX_LAM : EX_SAM, s->pc);
+  return false;
+}
+
 static int decode_exec(Decode *s) {
   int dest = 0;
   word_t src1 = 0, src2 = 0, imm = 0;
   s->dnpc = s->snpc;
+  if (unlikely(!amo_check(s))) return 0;
 
 #define INSTPAT_INST(s) ((s)->isa.inst.val)
 #define INSTPAT_MATCH(s, name, type, ... /* execute body */ ) { \
@@ -58,10 +114,108 @@ static int decode_exec(Decode *s) {
 }
 
   INSTPAT_START();
+  INSTPAT("??????? ????? ????? ??? ????? 01101 11", lui    , U, R(dest) = imm);
   INSTPAT("??????? ????? ????? ??? ????? 00101 11", auipc  , U, R(dest) = s->pc + imm);
+  INSTPAT("??????? ????? ????? ??? ????? 11011 11", jal    , J, R(dest) = s->snpc; s->dnpc = s->pc + imm);
+  INSTPAT("??????? ????? ????? 000 ????? 11001 11", jalr   , I, R(dest) = s->snpc; s->dnpc = (src1 + imm) & ~(word_t)1);
+
+  INSTPAT("??????? ????? ????? 000 ????? 11000 11", beq    , B, if (src1 == src2) s->dnpc = s->pc + imm);
+  INSTPAT("??????? ????? ????? 001 ????? 11000 11", bne    , B, if (src1 != src2) s->dnpc = s->pc + imm);
+  INSTPAT("??????? ????? ????? 100 ????? 11000 11", blt    , B, if ((sword_t)src1 <  (sword_t)src2) s->dnpc = s->pc + imm);
+  INSTPAT("??????? ????? ????? 101 ????? 11000 11", bge    , B, if ((sword_t)src1 >= (sword_t)src2) s->dnpc = s->pc + imm);
+  INSTPAT("??????? ????? ????? 110 ????? 11000 11", bltu   , B, if (src1 <  src2) s->dnpc = s->pc + imm);
+  INSTPAT("??????? ????? ????? 111 ????? 11000 11", bgeu   , B, if (src1 >= src2) s->dnpc = s->pc + imm);
+
+  INSTPAT("??????? ????? ????? 000 ????? 00000 11", lb     , I, R(dest) = SEXT(Mr(src1 + imm, 1), 8));
+  INSTPAT("??????? ????? ????? 001 ????? 00000 11", lh     , I, R(dest) = SEXT(Mr(src1 + imm, 2), 16));
+  INSTPAT("??????? ????? ????? 010 ????? 00000 11", lw     , I, R(dest) = SEXT(Mr(src1 + imm, 4), 32));
   INSTPAT("??????? ????? ????? 011 ????? 00000 11", ld     , I, R(dest) = Mr(src1 + imm, 8));
+  INSTPAT("??????? ????? ????? 100 ????? 00000 11", lbu    , I, R(dest) = Mr(src1 + imm, 1));
+  INSTPAT("??????? ????? ????? 101 ????? 00000 11", lhu    , I, R(dest) = Mr(src1 + imm, 2));
+  INSTPAT("??????? ????? ????? 110 ????? 00000 11", lwu    , I, R(dest) = Mr(src1 + imm, 4));
+  INSTPAT("??????? ????? ????? 000 ????? 01000 11", sb     , S, Mw(src1 + imm, 1, src2));
+  INSTPAT("??????? ????? ????? 001 ????? 01000 11", sh     , S, Mw(src1 + imm, 2, src2));
+  INSTPAT("??????? ????? ????? 010 ????? 01000 11", sw     , S, Mw(src1 + imm, 4, src2));
   INSTPAT("??????? ????? ????? 011 ????? 01000 11", sd     , S, Mw(src1 + imm, 8, src2));
 
+  INSTPAT("??????? ????? ????? 000 ????? 00100 11", addi   , I, R(dest) = src1 + imm);
+  INSTPAT("??????? ????? ????? 010 ????? 00100 11", slti   , I, R(dest) = (sword_t)src1 < (sword_t)imm);
+  INSTPAT("??????? ????? ????? 011 ????? 00100 11", sltiu  , I, R(dest) = src1 < imm);
+  INSTPAT("??????? ????? ????? 100 ????? 00100 11", xori   , I, R(dest) = src1 ^ imm);
+  INSTPAT("??????? ????? ????? 110 ????? 00100 11", ori    , I, R(dest) = src1 | imm);
+  INSTPAT("??????? ????? ????? 111 ????? 00100 11", andi   , I, R(dest) = src1 & imm);
+  INSTPAT("000000? ????? ????? 001 ????? 00100 11", slli   , I, R(dest) = src1 << BITS(imm, 5, 0));
+  INSTPAT("000000? ????? ????? 101 ????? 00100 11", srli   , I, R(dest) = src1 >> BITS(imm, 5, 0));
+  INSTPAT("010000? ????? ????? 101 ????? 00100 11", srai   , I, R(dest) = (sword_t)src1 >> BITS(imm, 5, 0));
+
+  INSTPAT("0000000 ????? ????? 000 ????? 01100 11", add    , R, R(dest) = src1 + src2);
+  INSTPAT("0100000 ????? ????? 000 ????? 01100 11", sub    , R, R(dest) = src1 - src2);
+  INSTPAT("0000000 ????? ????? 001 ????? 01100 11", sll    , R, R(dest) = src1 << BITS(src2, 5, 0));
+  INSTPAT("0000000 ????? ????? 010 ????? 01100 11", slt    , R, R(dest) = (sword_t)src1 < (sword_t)src2);
+  INSTPAT("0000000 ????? ????? 011 ????? 01100 11", sltu   , R, R(dest) = src1 < src2);
+  INSTPAT("0000000 ????? ????? 100 ????? 01100 11", xor    , R, R(dest) = src1 ^ src2);
+  INSTPAT("0000000 ????? ????? 101 ????? 01100 11", srl    , R, R(dest) = src1 >> BITS(src2, 5, 0));
+  INSTPAT("0100000 ????? ????? 101 ????? 01100 11", sra    , R, R(dest) = (sword_t)src1 >> BITS(src2, 5, 0));
+  INSTPAT("0000000 ????? ????? 110 ????? 01100 11", or     , R, R(dest) = src1 | src2);
+  INSTPAT("0000000 ????? ????? 111 ????? 01100 11", and    , R, R(dest) = src1 & src2);
+
+  INSTPAT("??????? ????? ????? 000 ????? 00110 11", addiw  , I, R(dest) = SEXT(src1 + imm, 32));
+  INSTPAT("0000000 ????? ????? 001 ????? 00110 11", slliw  , I, R(dest) = SEXT((uint32_t)src1 << BITS(imm, 4, 0), 32));
+  INSTPAT("0000000 ????? ????? 101 ????? 00110 11", srliw  , I, R(dest) = SEXT((uint32_t)src1 >> BITS(imm, 4, 0), 32));
+  INSTPAT("0100000 ????? ????? 101 ????? 00110 11", sraiw  , I, R(dest) = SEXT((int32_t)src1 >> BITS(imm, 4, 0), 32));
+  INSTPAT("0000000 ????? ????? 000 ????? 01110 11", addw   , R, R(dest) = SEXT(src1 + src2, 32));
+  INSTPAT("0100000 ????? ????? 000 ????? 01110 11", subw   , R, R(dest) = SEXT(src1 - src2, 32));
+  INSTPAT("0000000 ????? ????? 001 ????? 01110 11", sllw   , R, R(dest) = SEXT((uint32_t)src1 << BITS(src2, 4, 0), 32));
+  INSTPAT("0000000 ????? ????? 101 ????? 01110 11", srlw   , R, R(dest) = SEXT((uint32_t)src1 >> BITS(src2, 4, 0), 32));
+  INSTPAT("0100000 ????? ????? 101 ????? 01110 11", sraw   , R, R(dest) = SEXT((int32_t)src1 >> BITS(src2, 4, 0), 32));
+
+  INSTPAT("0000001 ????? ????? 000 ????? 01100 11", mul    , R, R(dest) = src1 * src2);
+  INSTPAT("0000001 ????? ????? 001 ????? 01100 11", mulh   , R, R(dest) = mulh_ss(src1, src2));
+  INSTPAT("0000001 ????? ????? 010 ????? 01100 11", mulhsu , R, R(dest) = mulh_su(src1, src2));
+  INSTPAT("0000001 ????? ????? 011 ????? 01100 11", mulhu  , R, R(dest) = mulh_uu(src1, src2));
+  INSTPAT("0000001 ????? ????? 100 ????? 01100 11", div    , R, R(dest) = div_s(src1, src2));
+  INSTPAT("0000001 ????? ????? 101 ????? 01100 11", divu   , R, R(dest) = div_u(src1, src2));
+  INSTPAT("0000001 ????? ????? 110 ????? 01100 11", rem    , R, R(dest) = rem_s(src1, src2));
+  INSTPAT("0000001 ????? ????? 111 ????? 01100 11", remu   , R, R(dest) = rem_u(src1, src2));
+  INSTPAT("0000001 ????? ????? 000 ????? 01110 11", mulw   , R, R(dest) = SEXT(src1 * src2, 32));
+  INSTPAT("0000001 ????? ????? 100 ????? 01110 11", divw   , R, R(dest) = SEXT(div_s((int32_t)src1, (int32_t)src2), 32));
+  INSTPAT("0000001 ????? ????? 101 ????? 01110 11", divuw  , R, R(dest) = SEXT(div_u((uint32_t)src1, (uint32_t)src2), 32));
+  INSTPAT("0000001 ????? ????? 110 ????? 01110 11", remw   , R, R(dest) = SEXT(rem_s((int32_t)src1, (int32_t)src2), 32));
+  INSTPAT("0000001 ????? ????? 111 ????? 01110 11", remuw  , R, R(dest) = SEXT(rem_u((uint32_t)src1, (uint32_t)src2), 32));
+
+  INSTPAT("00010?? 00000 ????? 010 ????? 01011 11", lr.w     , R, R(dest) = SEXT(lr(src1, 4), 32));
+  INSTPAT("00011?? ????? ????? 010 ????? 01011 11", sc.w     , R, R(dest) = sc(src1, 4, src2));
+  INSTPAT("00001?? ????? ????? 010 ????? 01011 11", amoswap.w, R, R(dest) = SEXT(Ma(src1, 4, AMO_SWAP, src2), 32));
+  INSTPAT("00000?? ????? ????? 010 ????? 01011 11", amoadd.w , R, R(dest) = SEXT(Ma(src1, 4, AMO_ADD , src2), 32));
+  INSTPAT("00100?? ????? ????? 010 ????? 01011 11", amoxor.w , R, R(dest) = SEXT(Ma(src1, 4, AMO_XOR , src2), 32));
+  INSTPAT("01100?? ????? ????? 010 ????? 01011 11", amoand.w , R, R(dest) = SEXT(Ma(src1, 4, AMO_AND , src2), 32));
+  INSTPAT("01000?? ????? ????? 010 ????? 01011 11", amoor.w  , R, R(dest) = SEXT(Ma(src1, 4, AMO_OR  , src2), 32));
+  INSTPAT("10000?? ????? ????? 010 ????? 01011 11", amomin.w , R, R(dest) = SEXT(Ma(src1, 4, AMO_MIN , src2), 32));
+  INSTPAT("10100?? ????? ????? 010 ????? 01011 11", amomax.w , R, R(dest) = SEXT(Ma(src1, 4, AMO_MAX , src2), 32));
+  INSTPAT("11000?? ????? ????? 010 ????? 01011 11", amominu.w, R, R(dest) = SEXT(Ma(src1, 4, AMO_MINU, src2), 32));
+  INSTPAT("11100?? ????? ????? 010 ????? 01011 11", amomaxu.w, R, R(dest) = SEXT(Ma(src1, 4, AMO_MAXU, src2), 32));
+  INSTPAT("00010?? 00000 ????? 011 ????? 01011 11", lr.d     , R, R(dest) = lr(src1, 8));
+  INSTPAT("00011?? ????? ????? 011 ????? 01011 11", sc.d     , R, R(dest) = sc(src1, 8, src2));
+  INSTPAT("00001?? ????? ????? 011 ????? 01011 11", amoswap.d, R, R(dest) = Ma(src1, 8, AMO_SWAP, src2));
+  INSTPAT("00000?? ????? ????? 011 ????? 01011 11", amoadd.d , R, R(dest) = Ma(src1, 8, AMO_ADD , src2));
+  INSTPAT("00100?? ????? ????? 011 ????? 01011 11", amoxor.d , R, R(dest) = Ma(src1, 8, AMO_XOR , src2));
+  INSTPAT("01100?? ????? ????? 011 ????? 01011 11", amoand.d , R, R(dest) = Ma(src1, 8, AMO_AND , src2));
+  INSTPAT("01000?? ????? ????? 011 ????? 01011 11", amoor.d  , R, R(dest) = Ma(src1, 8, AMO_OR  , src2));
+  INSTPAT("10000?? ????? ????? 011 ????? 01011 11", amomin.d , R, R(dest) = Ma(src1, 8, AMO_MIN , src2));
+  INSTPAT("10100?? ????? ????? 011 ????? 01011 11", amomax.d , R, R(dest) = Ma(src1, 8, AMO_MAX , src2));
+  INSTPAT("11000?? ????? ????? 011 ????? 01011 11", amominu.d, R, R(dest) = Ma(src1, 8, AMO_MINU, src2));
+  INSTPAT("11100?? ????? ????? 011 ????? 01011 11", amomaxu.d, R, R(dest) = Ma(src1, 8, AMO_MAXU, src2));
+
+  INSTPAT("???? ???? ???? ????? 000 ????? 00011 11", fence  , N, __atomic_thread_fence(__ATOMIC_SEQ_CST));
+  INSTPAT("???? ???? ???? ????? 001 ????? 00011 11", fence.i, N, );
+  INSTPAT("??????? ????? ????? 001 ????? 11100 11", csrrw  , I, csr_access(s, dest, imm, CSR_RW, src1));
+  INSTPAT("??????? ????? ????? 010 ????? 11100 11", csrrs  , I, csr_access(s, dest, imm, CSR_RS, src1));
+  INSTPAT("??????? ????? ????? 011 ????? 11100 11", csrrc  , I, csr_access(s, dest, imm, CSR_RC, src1));
+  INSTPAT("??????? ????? ????? 101 ????? 11100 11", csrrwi , I, csr_access(s, dest, imm, CSR_RW, BITS(INSTPAT_INST(s), 19, 15)));
+  INSTPAT("??????? ????? ????? 110 ????? 11100 11", csrrsi , I, csr_access(s, dest, imm, CSR_RS, BITS(INSTPAT_INST(s), 19, 15)));
+  INSTPAT("??????? ????? ????? 111 ????? 11100 11", csrrci , I, csr_access(s, dest, imm, CSR_RC, BITS(INSTPAT_INST(s), 19, 15)));
+  INSTPAT("0000000 00000 00000 000 00000 11100 11", ecall  , N, s->dnpc = isa_raise_intr(EX_ECM, s->pc));
+  INSTPAT("0011000 00010 00000 000 00000 11100 11", mret   , N, s->dnpc = trap_return());
   INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
   INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc));
   INSTPAT_END();
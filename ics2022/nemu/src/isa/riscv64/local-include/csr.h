@@ -0,0 +1,45 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __RISCV64_CSR_H__
+#define __RISCV64_CSR_H__
+
+#include <common.h>
+
+enum {
+  CSR_MSTATUS = 0x300, CSR_MTVEC = 0x305,
+  CSR_MSCRATCH = 0x340, CSR_MEPC = 0x341, CSR_MCAUSE = 0x342,
+  CSR_MHARTID = 0xf14,
+};
+
+// only M-mode is implemented, so MPP is always M
+#define MSTATUS_MIE  (1ull << 3)
+#define MSTATUS_MPIE (1ull << 7)
+#define MSTATUS_MPP  (3ull << 11)
+
+#define INTR_BIT (1ull << 63)
+
+// exception codes
+enum { EX_LAM = 4, EX_SAM = 6, EX_ECM = 11 };
+
+/* Accesses of `csr` from M-mode. They return false if the access is
+ * illegal, i.e. the CSR does not exist or is read-only for a write. */
+bool csr_read(int csr, word_t *val);
+bool csr_write(int csr, word_t val);
+
+/* mret, returns the new pc */
+vaddr_t trap_return();
+
+#endif
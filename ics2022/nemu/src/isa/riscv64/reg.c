@@ -24,8 +24,48 @@ const char *regs[] = {
 };
 
 void isa_reg_display() {
+  int i;
+  for (i = 0; i < 32; i ++) {
+    printf("%-4s " FMT_WORD "%c", regs[i], gpr(i), (i % 4 == 3 ? '\n' : ' '));
+  }
+  printf("%-4s " FMT_WORD "\n", "pc", cpu.pc);
+}
+
+// `s` is the name without the leading '$', e.g. "a0", "pc", and "$0" or "0" for x0
+int isa_reg_str2no(const char *s) {
+  int i;
+  if (strcmp(s, "pc") == 0) return 32;
+  if (strcmp(s, "0") == 0) return 0;
+  for (i = 0; i < 32; i ++) {
+    if (strcmp(s, regs[i]) == 0) return i;
+  }
+  return -1;
 }
 
 word_t isa_reg_str2val(const char *s, bool *success) {
-  return 0;
+  int no = isa_reg_str2no(s);
+  *success = (no >= 0);
+  return (*success ? *isa_gdb_reg(no) : 0);
+}
+
+// x0 to x31 and then pc, x0 is reset to 0 after every instruction anyway
+word_t* isa_gdb_reg(int no) {
+  if (no >= 0 && no < 32) return &cpu.gpr[no];
+  return (no == 32 ? &cpu.pc : NULL);
+}
+
+const char* isa_gdb_tdesc() {
+  static char buf[4096] = "";
+  if (buf[0] != '\0') return buf;
+  char *p = buf;
+  int i;
+  p += sprintf(p, "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+      "<target version=\"1.0\"><architecture>riscv:rv64</architecture>"
+      "<feature name=\"org.gnu.gdb.riscv.cpu\">");
+  for (i = 0; i < 32; i ++) {
+    p += sprintf(p, "<reg name=\"%s\" bitsize=\"64\" type=\"int\" regnum=\"%d\"/>",
+        (i == 0 ? "zero" : regs[i]), i);
+  }
+  strcpy(p, "<reg name=\"pc\" bitsize=\"64\" type=\"code_ptr\" regnum=\"32\"/></feature></target>");
+  return buf;
 }
@@ -0,0 +1,47 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include "../local-include/csr.h"
+
+/* Only the CSRs needed by the runtime in M-mode are implemented. */
+
+bool csr_read(int csr, word_t *val) {
+  switch (csr & 0xfff) {
+    case CSR_MSTATUS:  *val = cpu.mstatus; return true;
+    case CSR_MTVEC:    *val = cpu.mtvec; return true;
+    case CSR_MSCRATCH: *val = cpu.mscratch; return true;
+    case CSR_MEPC:     *val = cpu.mepc; return true;
+    case CSR_MCAUSE:   *val = cpu.mcause; return true;
+    case CSR_MHARTID:  *val = cpu.mhartid; return true;
+    default: return false;
+  }
+}
+
+// csr[11:10] = 3 means the CSR is read-only
+bool csr_write(int csr, word_t val) {
+  csr &= 0xfff;
+  if (BITS(csr, 11, 10) == 3) return false;
+  switch (csr) {
+    case CSR_MSTATUS:
+      cpu.mstatus = (val & (MSTATUS_MIE | MSTATUS_MPIE)) | MSTATUS_MPP;
+      return true;
+    case CSR_MTVEC:    cpu.mtvec = val & ~(word_t)2; return true;
+    case CSR_MSCRATCH: cpu.mscratch = val; return true;
+    case CSR_MEPC:     cpu.mepc = val & ~(word_t)1; return true;
+    case CSR_MCAUSE:   cpu.mcause = val; return true;
+    default: return false;
+  }
+}
@@ -14,13 +14,26 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include "../local-include/csr.h"
 
-word_t isa_raise_intr(word_t NO, vaddr_t epc) {
-  /* TODO: Trigger an interrupt/exception with ``NO''.
-   * Then return the address of the interrupt/exception vector.
-   */
+// all traps are taken in M-mode, which is the only mode
+vaddr_t isa_raise_intr(word_t NO, vaddr_t epc) {
+  perf_trap(NO & INTR_BIT, NO & ~INTR_BIT);
+  cpu.mepc = epc;
+  cpu.mcause = NO;
+  // MPIE = MIE, MIE = 0
+  cpu.mstatus = (cpu.mstatus & ~(MSTATUS_MIE | MSTATUS_MPIE)) |
+    ((cpu.mstatus & MSTATUS_MIE) ? MSTATUS_MPIE : 0);
+  // interrupts jump to base + 4 * code in the vectored mode
+  bool vectored = (cpu.mtvec & 1) && (NO & INTR_BIT);
+  return (cpu.mtvec & ~(word_t)3) + (vectored ? 4 * (NO & ~INTR_BIT) : 0);
+}
 
-  return 0;
+vaddr_t trap_return() {
+  // MIE = MPIE, MPIE = 1
+  cpu.mstatus = (cpu.mstatus & ~MSTATUS_MIE) |
+    ((cpu.mstatus & MSTATUS_MPIE) ? MSTATUS_MIE : 0) | MSTATUS_MPIE;
+  return cpu.mepc;
 }
 
 word_t isa_query_intr() {
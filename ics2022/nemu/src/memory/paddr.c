@@ -13,17 +13,27 @@
  * See the Mulan PSL v2 for more details.
  ***************************************************************************************/
 
+#define _GNU_SOURCE // memfd_create()
 #include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
 #include <device/mmio.h>
+#include <cpu/difftest.h>
 #include <isa.h>
+#ifdef CONFIG_PMEM_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
-#if defined(CONFIG_PMEM_MALLOC)
-static uint8_t *pmem = NULL;
-#else // CONFIG_PMEM_GARRAY
-static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
+#ifdef CONFIG_PMEM_GARRAY
+// used by the first instance, the others fall back to malloc()
+static uint8_t pmem_array[CONFIG_MSIZE] PG_ALIGN = {};
+static bool pmem_array_used = false;
 #endif
 
+// pmem of the current instance
+#define pmem (nemu->pmem)
+
 uint8_t *guest_to_host(paddr_t paddr)
 {
 	return pmem + paddr - CONFIG_MBASE;
@@ -36,11 +46,217 @@ static word_t pmem_read(paddr_t addr, int len)
 	return ret;
 }
 
+#ifdef CONFIG_PMEM_DIRTY
+#define NR_PMEM_PAGE (CONFIG_MSIZE / PAGE_SIZE)
+#define PMEM_DIRTY_SIZE ((NR_PMEM_PAGE + 63) / 64 * sizeof(uint64_t))
+#define pmem_dirty (nemu->pmem_dirty)
+
+static inline void pmem_set_dirty(paddr_t addr)
+{
+	uint32_t pg = (addr - CONFIG_MBASE) >> PAGE_SHIFT;
+	pmem_dirty[pg / 64] |= 1ull << (pg % 64);
+}
+
+const uint64_t *pmem_dirty_map(size_t *nr_page)
+{
+	*nr_page = NR_PMEM_PAGE;
+	return pmem_dirty;
+}
+
+void pmem_dirty_clear()
+{
+	memset(pmem_dirty, 0, PMEM_DIRTY_SIZE);
+}
+#endif
+
+#ifdef CONFIG_TARGET_SHARE
+#define NR_PMEM_STORE_LOG 4096
+#define pmem_store (nemu->pmem_store)
+#define nr_pmem_store (nemu->nr_pmem_store)
+
+static inline void pmem_log_store(paddr_t addr, int len, word_t data)
+{
+	if (nr_pmem_store < NR_PMEM_STORE_LOG)
+	{
+		pmem_store[nr_pmem_store] = (DifftestStore){.addr = addr, .data = data, .len = len};
+	}
+	nr_pmem_store++;
+}
+
+const DifftestStore *pmem_store_log(size_t *nr)
+{
+	*nr = nr_pmem_store;
+	// the log is useless if some stores are dropped
+	return (nr_pmem_store <= NR_PMEM_STORE_LOG ? pmem_store : NULL);
+}
+
+void pmem_store_log_clear()
+{
+	nr_pmem_store = 0;
+}
+#endif
+
+#ifdef CONFIG_REVERSE_EXEC
+#define NR_UNDO_PAGE (CONFIG_MSIZE / PAGE_SIZE)
+
+struct PmemUndo
+{
+	uint32_t nr, cap;
+	uint32_t *pg;
+	uint8_t *data; // the contents of pg[i] are at data + i * PAGE_SIZE
+};
+
+static PmemUndo *undo = NULL; // the open log
+// pages recorded in the open log, all of them are set if no log is open
+static uint64_t undo_saved[(NR_UNDO_PAGE + 63) / 64];
+
+static void pmem_undo_save(uint32_t pg)
+{
+	undo_saved[pg / 64] |= 1ull << (pg % 64);
+	if (undo->nr == undo->cap)
+	{
+		undo->cap = (undo->cap == 0 ? 64 : undo->cap * 2);
+		undo->pg = realloc(undo->pg, sizeof(undo->pg[0]) * undo->cap);
+		undo->data = realloc(undo->data, PAGE_SIZE * undo->cap);
+		assert(undo->pg && undo->data);
+	}
+	undo->pg[undo->nr] = pg;
+	memcpy(undo->data + PAGE_SIZE * undo->nr, pmem + ((size_t)pg << PAGE_SHIFT), PAGE_SIZE);
+	undo->nr++;
+}
+
+// called before a store, only the first store to a page since the log is opened records it
+static inline void pmem_undo_record(paddr_t addr, int len)
+{
+	uint32_t pg = (addr - CONFIG_MBASE) >> PAGE_SHIFT;
+	uint32_t pg_end = (addr + len - 1 - CONFIG_MBASE) >> PAGE_SHIFT;
+	if (unlikely(!(undo_saved[pg / 64] & (1ull << (pg % 64)))))
+		pmem_undo_save(pg);
+	if (unlikely(!(undo_saved[pg_end / 64] & (1ull << (pg_end % 64)))))
+		pmem_undo_save(pg_end);
+}
+
+PmemUndo *pmem_undo_begin()
+{
+	undo = calloc(1, sizeof(*undo));
+	assert(undo);
+	memset(undo_saved, 0, sizeof(undo_saved));
+	return undo;
+}
+
+void pmem_undo_apply(PmemUndo *log)
+{
+	uint32_t i;
+	for (i = 0; i < log->nr; i++)
+	{
+		memcpy(pmem + ((size_t)log->pg[i] << PAGE_SHIFT), log->data + PAGE_SIZE * i, PAGE_SIZE);
+	}
+}
+
+void pmem_undo_free(PmemUndo *log)
+{
+	if (log == undo)
+	{
+		undo = NULL;
+		memset(undo_saved, 0xff, sizeof(undo_saved));
+	}
+	free(log->pg);
+	free(log->data);
+	free(log);
+}
+#endif
+
+#ifdef CONFIG_WATCHPOINT
+static paddr_t watch_lo = 1, watch_hi = 0;
+
+void paddr_watch(paddr_t lo, paddr_t hi)
+{
+	watch_lo = lo;
+	watch_hi = hi;
+}
+
+void wp_store_hook(paddr_t addr, int len);
+#endif
+
+// bookkeeping of a store to pmem, after the data is written
+static inline void pmem_record_write(paddr_t addr, int len, word_t data)
+{
+	IFDEF(CONFIG_WATCHPOINT, if (unlikely(addr <= watch_hi && addr + len > watch_lo)) wp_store_hook(addr, len));
+	IFDEF(CONFIG_PMEM_DIRTY, pmem_set_dirty(addr));
+	IFDEF(CONFIG_PMEM_DIRTY, pmem_set_dirty(addr + len - 1));
+	IFDEF(CONFIG_TARGET_SHARE, pmem_log_store(addr, len, data & DIFFTEST_STORE_MASK(len)));
+}
+
 static void pmem_write(paddr_t addr, int len, word_t data)
 {
+	IFDEF(CONFIG_REVERSE_EXEC, pmem_undo_record(addr, len));
 	host_write(guest_to_host(addr), len, data);
+	pmem_record_write(addr, len, data);
+}
+
+#ifdef CONFIG_MEM_RANDOM
+// random but deterministic content of pmem at `addr`
+static inline uint32_t pmem_random(paddr_t addr)
+{
+	uint64_t x = addr * 0x9e3779b97f4a7c15ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
 }
 
+// fill `buf` with the random content of pmem at `addr`
+static void pmem_fill_random(void *buf, paddr_t addr, size_t len)
+{
+	uint32_t *p = buf;
+	size_t i;
+	for (i = 0; i < len / sizeof(p[0]); i++)
+	{
+		p[i] = pmem_random(addr + i * sizeof(p[0]));
+	}
+}
+#endif
+
+#if defined(CONFIG_PMEM_MMAP) && defined(CONFIG_MEM_RANDOM)
+#include <signal.h>
+
+#define PMEM_READY_SIZE ((CONFIG_MSIZE / PAGE_SIZE + 63) / 64 * sizeof(uint64_t))
+
+// Pages of pmem are inaccessible at first. The first access to a page traps
+// here to fill it with random content and make it accessible. pmem is a
+// shared mapping of a memory file, and the page is filled by writing the
+// file while it is still inaccessible, so that other harts never see it
+// half-filled. The file holds the only copy of the page, and it belongs to
+// a single instance, since batch workers fork before init_mem().
+// Note that the kernel does not trap but fails when accessing such pages
+// in system calls, so read() should not write into pmem directly.
+static void pmem_fault_handler(int sig, siginfo_t *info, void *ucontext)
+{
+	// harts may fault on the same page at the same time
+	static bool lock = false;
+	static uint32_t buf[PAGE_SIZE / sizeof(uint32_t)];
+	uint8_t *haddr = info->si_addr;
+	if (haddr < pmem || haddr >= pmem + CONFIG_MSIZE)
+	{
+		// a real segmentation fault, crash with the default handler after returning
+		signal(SIGSEGV, SIG_DFL);
+		return;
+	}
+	uint32_t pg = (haddr - pmem) >> PAGE_SHIFT;
+	uint8_t *page = pmem + ((size_t)pg << PAGE_SHIFT);
+	while (__atomic_test_and_set(&lock, __ATOMIC_ACQUIRE))
+		;
+	if (!(nemu->pmem_ready[pg / 64] & (1ull << (pg % 64))))
+	{
+		pmem_fill_random(buf, host_to_guest(page), PAGE_SIZE);
+		ssize_t ret = pwrite(nemu->pmem_fd, buf, PAGE_SIZE, (off_t)pg << PAGE_SHIFT);
+		assert(ret == PAGE_SIZE);
+		mprotect(page, PAGE_SIZE, PROT_READ | PROT_WRITE);
+		nemu->pmem_ready[pg / 64] |= 1ull << (pg % 64);
+	}
+	__atomic_clear(&lock, __ATOMIC_RELEASE);
+}
+#endif
+
 static void out_of_bound(paddr_t addr)
 {
 	panic("address = " FMT_PADDR " is out of bound of pmem [" FMT_PADDR ", " FMT_PADDR "] at pc = " FMT_WORD,
@@ -49,27 +265,145 @@ static void out_of_bound(paddr_t addr)
 
 void init_mem()
 {
-#if defined(CONFIG_PMEM_MALLOC)
+#if defined(CONFIG_PMEM_GARRAY)
+	if (!pmem_array_used)
+	{
+		pmem = pmem_array;
+		pmem_array_used = true;
+	}
+	else
+	{
+		pmem = calloc(1, CONFIG_MSIZE);
+		assert(pmem);
+	}
+#elif defined(CONFIG_PMEM_MALLOC)
 	pmem = malloc(CONFIG_MSIZE);
 	assert(pmem);
+#elif defined(CONFIG_PMEM_MMAP) && defined(CONFIG_MEM_RANDOM)
+	nemu->pmem_fd = memfd_create("pmem", MFD_CLOEXEC);
+	assert(nemu->pmem_fd >= 0);
+	int ret = ftruncate(nemu->pmem_fd, CONFIG_MSIZE);
+	assert(ret == 0);
+	pmem = mmap(NULL, CONFIG_MSIZE, PROT_NONE, MAP_SHARED | MAP_NORESERVE, nemu->pmem_fd, 0);
+	assert(pmem != MAP_FAILED);
+#elif defined(CONFIG_PMEM_MMAP)
+	pmem = mmap(NULL, CONFIG_MSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	assert(pmem != MAP_FAILED);
 #endif
 #ifdef CONFIG_MEM_RANDOM
-	uint32_t *p = (uint32_t *)pmem;
-	int i;
-	for (i = 0; i < (int)(CONFIG_MSIZE / sizeof(p[0])); i++)
+#ifdef CONFIG_PMEM_MMAP
+	nemu->pmem_ready = calloc(1, PMEM_READY_SIZE);
+	assert(nemu->pmem_ready);
+	struct sigaction sa = {.sa_sigaction = pmem_fault_handler, .sa_flags = SA_SIGINFO};
+	sigemptyset(&sa.sa_mask);
+	ret = sigaction(SIGSEGV, &sa, NULL);
+	assert(ret == 0);
+#else
+	pmem_fill_random(pmem, CONFIG_MBASE, CONFIG_MSIZE);
+#endif
+#endif
+#ifdef CONFIG_PMEM_DIRTY
+	pmem_dirty = calloc(1, PMEM_DIRTY_SIZE);
+	assert(pmem_dirty);
+#endif
+	IFDEF(CONFIG_REVERSE_EXEC, memset(undo_saved, 0xff, sizeof(undo_saved)));
+#ifdef CONFIG_TARGET_SHARE
+	pmem_store = malloc(sizeof(pmem_store[0]) * NR_PMEM_STORE_LOG);
+	assert(pmem_store);
+#endif
+	Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
+}
+
+#ifdef CONFIG_PMEM_MMAP
+/* Map the file at `off` to pmem at `paddr` copy-on-write instead of copying
+ * it, only whole pages are mapped. Return the number of bytes mapped. */
+size_t pmem_map_file(paddr_t paddr, int fd, off_t off, size_t len)
+{
+	if (paddr % PAGE_SIZE != 0 || off % PAGE_SIZE != 0)
+		return 0;
+	len &= ~(PAGE_SIZE - 1);
+	if (len == 0)
+		return 0;
+	void *p = mmap(guest_to_host(paddr), len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, off);
+	if (p == MAP_FAILED)
+		return 0;
+#ifdef CONFIG_MEM_RANDOM
+	uint32_t pg;
+	for (pg = (paddr - CONFIG_MBASE) >> PAGE_SHIFT; pg < (paddr - CONFIG_MBASE + len) >> PAGE_SHIFT; pg++)
+		nemu->pmem_ready[pg / 64] |= 1ull << (pg % 64);
+#endif
+	return len;
+}
+#endif
+
+#ifdef CONFIG_SNAPSHOT
+/* Whether [paddr, paddr + len) in one page still has its initial content,
+ * i.e. zero or the random content. A page which is not accessed yet is not
+ * made accessible by the check. */
+bool pmem_is_initial(paddr_t paddr, size_t len)
+{
+	uint8_t *haddr = guest_to_host(paddr);
+#ifdef CONFIG_MEM_RANDOM
+#ifdef CONFIG_PMEM_MMAP
+	uint32_t pg = (paddr - CONFIG_MBASE) >> PAGE_SHIFT;
+	if (!(nemu->pmem_ready[pg / 64] & (1ull << (pg % 64))))
+		return true;
+#endif
+	size_t i;
+	for (i = 0; i + sizeof(uint32_t) <= len; i += sizeof(uint32_t))
 	{
-		p[i] = rand();
+		if (*(uint32_t *)(haddr + i) != pmem_random(paddr + i))
+			return false;
 	}
+	return true;
+#else
+	static const uint8_t zero[PAGE_SIZE] = {};
+	return memcmp(haddr, zero, len) == 0;
 #endif
-	Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
 }
 
-word_t paddr_read(paddr_t addr, int len)
+/* Bring all of pmem back to its initial content. With mmap(), the pages are
+ * dropped instead of being written, and are initialized on demand again. */
+void pmem_reset()
 {
-#ifdef CONFIG_MTRACE
-    // log_write("[pread] @0x%x  %x  %d  %d\n",cpu.pc, addr,len, pmem_read(addr, len));
-	log_write("[pread] @0x%x  %x  %d\n",cpu.pc, addr, len);
+#if defined(CONFIG_PMEM_MMAP) && defined(CONFIG_MEM_RANDOM)
+	// also drop the pages mapped by pmem_map_file(), then the pages of the file
+	void *p = mmap(pmem, CONFIG_MSIZE, PROT_NONE, MAP_SHARED | MAP_NORESERVE | MAP_FIXED, nemu->pmem_fd, 0);
+	assert(p == pmem);
+	int ret = ftruncate(nemu->pmem_fd, 0);
+	ret |= ftruncate(nemu->pmem_fd, CONFIG_MSIZE);
+	assert(ret == 0);
+	memset(nemu->pmem_ready, 0, PMEM_READY_SIZE);
+#elif defined(CONFIG_PMEM_MMAP)
+	void *p = mmap(pmem, CONFIG_MSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+	assert(p == pmem);
+#elif defined(CONFIG_MEM_RANDOM)
+	pmem_fill_random(pmem, CONFIG_MBASE, CONFIG_MSIZE);
+#else
+	memset(pmem, 0, CONFIG_MSIZE);
+#endif
+}
 #endif
+
+void free_mem()
+{
+#if defined(CONFIG_PMEM_MMAP)
+	munmap(pmem, CONFIG_MSIZE);
+#else
+	if (MUXDEF(CONFIG_PMEM_GARRAY, pmem != pmem_array, true))
+	{
+		free(pmem);
+	}
+#endif
+	pmem = NULL;
+	free(nemu->pmem_ready);
+	IFDEF(CONFIG_PMEM_MMAP, IFDEF(CONFIG_MEM_RANDOM, close(nemu->pmem_fd)));
+	IFDEF(CONFIG_PMEM_DIRTY, free(pmem_dirty));
+	IFDEF(CONFIG_TARGET_SHARE, free(pmem_store));
+}
+
+word_t paddr_read(paddr_t addr, int len)
+{
 	if (likely(in_pmem(addr)))
 		return pmem_read(addr, len);
 	IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
@@ -79,15 +413,93 @@ word_t paddr_read(paddr_t addr, int len)
 
 void paddr_write(paddr_t addr, int len, word_t data)
 {
-#ifdef CONFIG_MTRACE
-    // log_write("[pwrite] @0x%x  %x  %d\n",cpu.pc, addr,len);
-	log_write("[pwrite] @0x%x  %x  %d  %d\n",cpu.pc, addr,len, data);
-#endif
 	if (likely(in_pmem(addr)))
 	{
+		difftest_log_store(addr, len, data);
 		pmem_write(addr, len, data);
 		return;
 	}
 	IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return );
 	out_of_bound(addr);
-}
\ No newline at end of file
+}
+
+void paddr_write_debug(paddr_t addr, const uint8_t *buf, int len)
+{
+	int i;
+	// the undo logs and watchpoints still see the data, but the store log of difftest does not
+	for (i = 0; i < len; i++)
+		pmem_write(addr + i, 1, buf[i]);
+	IFDEF(CONFIG_DIFFTEST, ref_difftest_memcpy(addr, guest_to_host(addr), len, DIFFTEST_TO_REF));
+}
+
+static word_t amo_apply(int op, int len, word_t old, word_t data)
+{
+	word_t mask = DIFFTEST_STORE_MASK(len);
+	// compare in the width of the access
+	sword_t sold = (len == 4 ? (int32_t)old : (sword_t)old);
+	sword_t sdata = (len == 4 ? (int32_t)data : (sword_t)data);
+	switch (op)
+	{
+	case AMO_SWAP: return data;
+	case AMO_ADD:  return old + data;
+	case AMO_XOR:  return old ^ data;
+	case AMO_AND:  return old & data;
+	case AMO_OR:   return old | data;
+	case AMO_MIN:  return (sold < sdata ? old : data);
+	case AMO_MAX:  return (sold > sdata ? old : data);
+	case AMO_MINU: return ((old & mask) < (data & mask) ? old : data);
+	case AMO_MAXU: return ((old & mask) > (data & mask) ? old : data);
+	default: panic("unknown AMO operation %d", op);
+	}
+}
+
+// Atomic accesses map onto host atomic operations, so they stay atomic
+// when several harts share pmem. Atomic accesses to devices are not supported.
+// They must be aligned, misaligned ones are trapped by the ISA beforehand.
+word_t paddr_amo(paddr_t addr, int len, int op, word_t data)
+{
+	if (unlikely(!in_pmem(addr)))
+	{
+		out_of_bound(addr);
+		return 0;
+	}
+	Assert((addr & (len - 1)) == 0, "misaligned atomic access at " FMT_PADDR, addr);
+	IFDEF(CONFIG_REVERSE_EXEC, pmem_undo_record(addr, len));
+	uint8_t *haddr = guest_to_host(addr);
+	word_t old = host_read(haddr, len);
+	word_t new = amo_apply(op, len, old, data);
+	// difftest requires a single hart, so the first try always succeeds
+	difftest_log_store(addr, len, new);
+	while (!host_cas(haddr, len, &old, new))
+	{
+		new = amo_apply(op, len, old, data);
+	}
+	pmem_record_write(addr, len, new);
+	mtrace(TRACE_READ, addr, len, old);
+	mtrace(TRACE_WRITE, addr, len, new);
+	return old;
+}
+
+bool paddr_cas(paddr_t addr, int len, word_t expect, word_t data)
+{
+	if (unlikely(!in_pmem(addr)))
+	{
+		out_of_bound(addr);
+		return false;
+	}
+	Assert((addr & (len - 1)) == 0, "misaligned atomic access at " FMT_PADDR, addr);
+	uint8_t *haddr = guest_to_host(addr);
+	if (host_read(haddr, len) != expect)
+	{
+		return false;
+	}
+	difftest_log_store(addr, len, data);
+	IFDEF(CONFIG_REVERSE_EXEC, pmem_undo_record(addr, len));
+	if (!host_cas(haddr, len, &expect, data))
+	{
+		return false;
+	}
+	pmem_record_write(addr, len, data);
+	mtrace(TRACE_WRITE, addr, len, data);
+	return true;
+}
@@ -20,10 +20,22 @@ word_t vaddr_ifetch(vaddr_t addr, int len) {
   return paddr_read(addr, len);
 }
 
+// instruction fetches are not traced
 word_t vaddr_read(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  word_t data = paddr_read(addr, len);
+  mtrace(TRACE_READ, addr, len, data);
+  return data;
 }
 
 void vaddr_write(vaddr_t addr, int len, word_t data) {
+  mtrace(TRACE_WRITE, addr, len, data);
   paddr_write(addr, len, data);
 }
+
+word_t vaddr_amo(vaddr_t addr, int len, int op, word_t data) {
+  return paddr_amo(addr, len, op, data);
+}
+
+bool vaddr_cas(vaddr_t addr, int len, word_t expect, word_t data) {
+  return paddr_cas(addr, len, expect, data);
+}
@@ -1,5 +1,196 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Functions in the symbol index are sorted by their start addresses, so
+ * looking up the function of a pc is a binary search. A function symbol
+ * without size ends where the next one starts. ELF files are mapped
+ * instead of read, and so are the segments aligned to pages in pmem.
+ */
+
 #include <elf.h>
-#include <stdio.h>
-#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <memory/paddr.h>
+#include "elfloader.h"
+
+#ifdef CONFIG_ISA64
+typedef Elf64_Ehdr Ehdr;
+typedef Elf64_Phdr Phdr;
+typedef Elf64_Shdr Shdr;
+typedef Elf64_Sym  Sym;
+#define ELF_CLASS ELFCLASS64
+#define ELF_ST_TYPE ELF64_ST_TYPE
+#else
+typedef Elf32_Ehdr Ehdr;
+typedef Elf32_Phdr Phdr;
+typedef Elf32_Shdr Shdr;
+typedef Elf32_Sym  Sym;
+#define ELF_CLASS ELFCLASS32
+#define ELF_ST_TYPE ELF32_ST_TYPE
+#endif
+
+typedef struct {
+  vaddr_t start, end;
+  char *name;
+} Symbol;
+
+static Symbol *syms = NULL;
+static int nr_sym = 0;
+
+// map the whole file read-only, return NULL if it is not an ELF file of the guest
+static const Ehdr* elf_open(const char *file, int *fd, size_t *size) {
+  *fd = open(file, O_RDONLY);
+  Assert(*fd >= 0, "Can not open '%s'", file);
+  struct stat st;
+  int ret = fstat(*fd, &st);
+  assert(ret == 0);
+  *size = st.st_size;
+  if (*size >= sizeof(Ehdr)) {
+    const Ehdr *eh = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, *fd, 0);
+    assert(eh != MAP_FAILED);
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) == 0) {
+      Assert(eh->e_ident[EI_CLASS] == ELF_CLASS, "'%s' is not a " str(__GUEST_ISA__) " ELF file", file);
+      return eh;
+    }
+    munmap((void *)eh, *size);
+  }
+  close(*fd);
+  return NULL;
+}
+
+static void elf_close(const Ehdr *eh, int fd, size_t size) {
+  munmap((void *)eh, size);
+  close(fd);
+}
+
+static int sym_cmp(const void *a, const void *b) {
+  vaddr_t x = ((const Symbol *)a)->start, y = ((const Symbol *)b)->start;
+  return (x > y) - (x < y);
+}
+
+// whether [off, off + len) is inside the file, without overflow
+static bool in_file(uint64_t off, uint64_t len, size_t size) {
+  return off <= size && len <= size - off;
+}
+
+static void add_symbols(const Ehdr *eh, size_t size, const char *file) {
+  const uint8_t *base = (const uint8_t *)eh;
+  if (eh->e_shoff == 0) return;
+  Assert(in_file(eh->e_shoff, (uint64_t)eh->e_shnum * sizeof(Shdr), size),
+      "section headers of '%s' are out of the file", file);
+  const Shdr *sh = (const Shdr *)(base + eh->e_shoff);
+  int i, j, n = 0;
+  for (i = 0; i < eh->e_shnum; i ++) {
+    if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum) continue;
+    const Shdr *str = &sh[sh[i].sh_link];
+    Assert(in_file(sh[i].sh_offset, sh[i].sh_size, size) && in_file(str->sh_offset, str->sh_size, size),
+        "symbol table %d of '%s' is out of the file", i, file);
+    const Sym *sym = (const Sym *)(base + sh[i].sh_offset);
+    const char *strtab = (const char *)(base + str->sh_offset);
+    int nr = sh[i].sh_size / sizeof(Sym);
+    syms = realloc(syms, sizeof(Symbol) * (nr_sym + nr));
+    assert(syms);
+    for (j = 0; j < nr; j ++) {
+      if (ELF_ST_TYPE(sym[j].st_info) != STT_FUNC || sym[j].st_shndx == SHN_UNDEF) continue;
+      // the name should be terminated inside the string table
+      Assert(sym[j].st_name < str->sh_size &&
+          memchr(strtab + sym[j].st_name, '\0', str->sh_size - sym[j].st_name) != NULL,
+          "name of symbol %d in '%s' is out of the string table", j, file);
+      syms[nr_sym + n] = (Symbol) {
+        .start = sym[j].st_value, .end = sym[j].st_value + sym[j].st_size,
+        .name = strdup(strtab + sym[j].st_name),
+      };
+      n ++;
+    }
+  }
+  nr_sym += n;
+  qsort(syms, nr_sym, sizeof(Symbol), sym_cmp);
+  for (i = 0; i < nr_sym; i ++) {
+    if (syms[i].end == syms[i].start) syms[i].end = (i + 1 < nr_sym ? syms[i + 1].start : syms[i].start + 1);
+  }
+  Log("%d function symbols are indexed", nr_sym);
+}
+
+bool elf_load_symbols(const char *file) {
+  int fd;
+  size_t size;
+  const Ehdr *eh = elf_open(file, &fd, &size);
+  if (eh == NULL) return false;
+  add_symbols(eh, size, file);
+  elf_close(eh, fd, size);
+  return true;
+}
+
+/* Load the segments and return the size of the image from RESET_VECTOR,
+ * which is what difftest copies to REF. Thus segments are not allowed to
+ * be placed below RESET_VECTOR. */
+long elf_load(const char *file, vaddr_t *entry) {
+  int fd;
+  size_t size;
+  const Ehdr *eh = elf_open(file, &fd, &size);
+  if (eh == NULL) return -1;
+
+  Assert(in_file(eh->e_phoff, (uint64_t)eh->e_phnum * sizeof(Phdr), size),
+      "program headers of '%s' are out of the file", file);
+  const Phdr *ph = (const Phdr *)((const uint8_t *)eh + eh->e_phoff);
+  paddr_t end = RESET_VECTOR;
+  int i;
+  for (i = 0; i < eh->e_phnum; i ++) {
+    if (ph[i].p_type != PT_LOAD || ph[i].p_memsz == 0) continue;
+    paddr_t addr = ph[i].p_paddr;
+    Assert(in_pmem(addr) && in_pmem(addr + ph[i].p_memsz - 1) && addr + ph[i].p_memsz > addr,
+        "segment [" FMT_PADDR ", " FMT_PADDR ") of '%s' is out of pmem",
+        addr, (paddr_t)(addr + ph[i].p_memsz), file);
+    Assert(addr >= RESET_VECTOR, "segment at " FMT_PADDR " of '%s' is below the reset vector " FMT_PADDR,
+        addr, file, (paddr_t)RESET_VECTOR);
+    Assert(ph[i].p_filesz <= ph[i].p_memsz && in_file(ph[i].p_offset, ph[i].p_filesz, size),
+        "segment [" FMT_PADDR ", " FMT_PADDR ") of '%s' is out of the file",
+        addr, (paddr_t)(addr + ph[i].p_memsz), file);
+    size_t mapped = MUXDEF(CONFIG_PMEM_MMAP, pmem_map_file(addr, fd, ph[i].p_offset, ph[i].p_filesz), 0);
+    memcpy(guest_to_host(addr + mapped), (const uint8_t *)eh + ph[i].p_offset + mapped, ph[i].p_filesz - mapped);
+    memset(guest_to_host(addr + ph[i].p_filesz), 0, ph[i].p_memsz - ph[i].p_filesz);
+    if (addr + ph[i].p_memsz > end) end = addr + ph[i].p_memsz;
+  }
+  *entry = eh->e_entry;
+  add_symbols(eh, size, file);
+  elf_close(eh, fd, size);
+  return end - RESET_VECTOR;
+}
+
+const char* elf_sym_lookup(vaddr_t pc, vaddr_t *start) {
+  int lo = 0, hi = nr_sym - 1;
+  // the last function starting no later than pc
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (syms[mid].start <= pc) lo = mid + 1;
+    else hi = mid - 1;
+  }
+  if (hi < 0 || pc >= syms[hi].end) return NULL;
+  if (start) *start = syms[hi].start;
+  return syms[hi].name;
+}
 
-// TODO
\ No newline at end of file
+bool elf_sym_addr(const char *name, vaddr_t *addr) {
+  int i;
+  for (i = 0; i < nr_sym; i ++) {
+    if (strcmp(syms[i].name, name) == 0) {
+      *addr = syms[i].start;
+      return true;
+    }
+  }
+  return false;
+}
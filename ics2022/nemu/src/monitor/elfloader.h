@@ -1,5 +1,21 @@
 #ifndef _ELFLOADER_H
 #define _ELFLOADER_H
 
-// TODO
-#endif
\ No newline at end of file
+#include <common.h>
+
+/* Load the PT_LOAD segments of the ELF `file` into pmem, and add its
+ * function symbols to the symbol index. Return the size of the image
+ * counted from RESET_VECTOR, or -1 if `file` is not an ELF file. */
+long elf_load(const char *file, vaddr_t *entry);
+
+/* Only add the function symbols of the ELF `file` to the symbol index,
+ * e.g. for a raw image built from it. */
+bool elf_load_symbols(const char *file);
+
+/* The symbol index shared by the monitor and tracers. */
+/* the function containing `pc` and its start address, NULL if unknown */
+const char* elf_sym_lookup(vaddr_t pc, vaddr_t *start);
+/* the start address of the function `name` */
+bool elf_sym_addr(const char *name, vaddr_t *addr);
+
+#endif
@@ -15,15 +15,20 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include <cpu/difftest.h>
 #include "ftrace.h"
 
 void init_rand();
 void init_log(const char *log_file);
 void init_mem();
 void init_difftest(char *ref_so_file, long img_size, int port);
+void init_snapshot();
 void init_device();
 void init_sdb();
 void init_disasm(const char *triple);
+void init_smp();
+char *batch_run(const char *manifest, int nr_worker, const char *report,
+    const char *baseline, int regress_threshold);
 static char *elf_file = NULL;
 static char *ramdisk_file = NULL;
 static char *appname = NULL;
@@ -42,11 +47,27 @@ static void welcome() {
 #include <getopt.h>
 
 void sdb_set_batch_mode();
+void sdb_set_gdb_port(int port);
 
 static char *log_file = NULL;
 static char *diff_so_file = NULL;
 static char *img_file = NULL;
 static int difftest_port = 1234;
+static char *diff_ff_pc = NULL;
+static char *restore_file = NULL;
+static char *manifest_file = NULL;
+static char *report_file = NULL;
+static int nr_worker = 0;
+static char *baseline_file = NULL;
+static int regress_threshold = 5;
+
+// the options of snapshot should not be ignored silently
+static void snapshot_check() {
+  if (!ISDEF(CONFIG_SNAPSHOT)) {
+    printf("snapshot is not enabled\n");
+    exit(1);
+  }
+}
 
 static long load_img() {
   if (img_file == NULL) {
@@ -54,6 +75,14 @@ static long load_img() {
     return 4096; // built-in image size
   }
 
+  vaddr_t entry;
+  long elf_size = elf_load(img_file, &entry);
+  if (elf_size >= 0) {
+    Log("The image is ELF file %s, size = %ld, entry = " FMT_WORD, img_file, elf_size, entry);
+    cpu.pc = entry;
+    return elf_size;
+  }
+
   FILE *fp = fopen(img_file, "rb");
   Assert(fp, "Can not open '%s'", img_file);
 
@@ -63,8 +92,13 @@ static long load_img() {
   Log("The image is %s, size = %ld", img_file, size);
 
   fseek(fp, 0, SEEK_SET);
-  int ret = fread(guest_to_host(RESET_VECTOR), size, 1, fp);
+  // pmem may not be accessible by the kernel before the first touch, read through a buffer
+  void *buf = malloc(size);
+  assert(buf);
+  int ret = fread(buf, size, 1, fp);
   assert(ret == 1);
+  memcpy(guest_to_host(RESET_VECTOR), buf, size);
+  free(buf);
 
   fclose(fp);
   return size;
@@ -76,8 +110,18 @@ static int parse_args(int argc, char *argv[]) {
     {"log"      , required_argument, NULL, 'l'},
     {"diff"     , required_argument, NULL, 'd'},
     {"port"     , required_argument, NULL, 'p'},
+    {"diff-ff"  , required_argument, NULL, 'f'},
+    {"restore"  , required_argument, NULL, 'R'},
+    {"save-at"  , required_argument, NULL, 'S'},
+    {"manifest" , required_argument, NULL, 'M'},
+    {"jobs"     , required_argument, NULL, 'j'},
+    {"report"   , required_argument, NULL, 'o'},
+    {"baseline" , required_argument, NULL, 'B'},
+    {"threshold", required_argument, NULL, 'T'},
     {"help"     , no_argument      , NULL, 'h'},
     {"elf"      , required_argument, NULL, 'e'},
+    {"gdb"      , required_argument, NULL, 'g'},
+    {"trace"    , required_argument, NULL, 't'},
     {0          , 0                , NULL,  0 },
   };
   int o;
@@ -85,18 +129,46 @@ static int parse_args(int argc, char *argv[]) {
     switch (o) {
       case 'b': sdb_set_batch_mode(); break;
       case 'p': sscanf(optarg, "%d", &difftest_port); break;
+      case 'f': diff_ff_pc = optarg; break;
+      case 'R': snapshot_check(); restore_file = optarg; break;
+      case 'S': {
+        snapshot_check();
+        char *file = strchr(optarg, ',');
+        if (file == NULL) goto usage;
+        IFDEF(CONFIG_SNAPSHOT, snapshot_save_at(strtoull(optarg, NULL, 0), file + 1));
+        break;
+      }
+      case 'M': manifest_file = optarg; sdb_set_batch_mode(); break;
+      case 'j': nr_worker = atoi(optarg); break;
+      case 'o': report_file = optarg; break;
+      case 'B': baseline_file = optarg; break;
+      case 'T': regress_threshold = atoi(optarg); break;
       case 'l': log_file = optarg; break;
       case 'd': diff_so_file = optarg; break;
       case 'e': elf_file = optarg; break;
+      case 'g': sdb_set_gdb_port(atoi(optarg)); break;
+      case 't': IFDEF(CONFIG_ACCESS_TRACE, trace_set_file(optarg)); break;
       case 'r': ramdisk_file = optarg; break;
       case 'a': appname = optarg; break;
       case 1: img_file = optarg; return 0;
       default:
+      usage:
         printf("Usage: %s [OPTION...] IMAGE [args]\n\n", argv[0]);
         printf("\t-b,--batch              run with batch mode\n");
         printf("\t-l,--log=FILE           output log to FILE\n");
         printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
+        printf("\t--diff-ff=PC            run DiffTest in lockstep only after reaching PC\n");
+        printf("\t--restore=FILE          restore the machine state from snapshot FILE\n");
+        printf("\t--save-at=N,FILE        save a snapshot to FILE after N instructions\n");
+        printf("\t--manifest=FILE         run the images listed in FILE in batch mode\n");
+        printf("\t--jobs=N                run the manifest with N workers (default: all cores)\n");
+        printf("\t--report=FILE           write the JSON report of the manifest to FILE\n");
+        printf("\t--baseline=FILE         compare inst/s of the manifest with the report FILE\n");
+        printf("\t--threshold=PCT         fail if inst/s drops by more than PCT%% (default: 5)\n");
+        printf("\t--elf=FILE              read the symbols from the ELF FILE of the raw IMAGE\n");
+        printf("\t--gdb=PORT              wait for GDB on PORT instead of starting sdb\n");
+        printf("\t--trace=FILE            write the memory and device trace to FILE\n");
         printf("\n");
         exit(0);
     }
@@ -116,23 +188,29 @@ void init_monitor(int argc, char *argv[]) {
   /* Open the log file. */
   init_log(log_file);
 
+  /* Run the images in the manifest with worker processes forked from here.
+   * Only the workers return, each with its own image. The rest of the
+   * initialization happens in the workers, since host resources such as the
+   * SDL window, the audio device and the interval timer can not be shared
+   * with or inherited by a forked process. */
+  if (manifest_file != NULL) img_file = batch_run(manifest_file, nr_worker, report_file,
+      baseline_file, regress_threshold);
+
   /* Initialize memory. */
   init_mem();
 
+  /* Initialize snapshot with the states of CPU and memory. */
+  IFDEF(CONFIG_SNAPSHOT, init_snapshot());
+
   /* Initialize devices. */
   IFDEF(CONFIG_DEVICE, init_device());
 
   /* Perform ISA dependent initialization. */
   init_isa();
 
-  /* Load the image to memory. This will overwrite the built-in image. */
-  long img_size = load_img();
+  /* Create the other harts, which share memory and devices with the first one. */
+  IFDEF(CONFIG_SMP, init_smp());
 
-  /* Initialize differential testing. */
-  init_difftest(diff_so_file, img_size, difftest_port);
-
-  // if (elf_file || (ramdisk_file && appname))
-  //   init_ftracer(elf_file, ramdisk_file, appname);
   /* Initialize the simple debugger. */
   init_sdb();
 
@@ -143,6 +221,27 @@ void init_monitor(int argc, char *argv[]) {
     MUXDEF(CONFIG_ISA_riscv64, "riscv64", "bad")))) "-pc-linux-gnu"
   ));
 
+  /* Load the image to memory. This will overwrite the built-in image. */
+  long img_size = load_img();
+
+  /* Index the symbols of the ELF file which the raw image is built from. */
+  if (elf_file != NULL) Assert(elf_load_symbols(elf_file), "'%s' is not an ELF file", elf_file);
+
+#ifdef CONFIG_SNAPSHOT
+  /* Restore the machine state from a snapshot, REF should get the whole memory then. */
+  if (restore_file != NULL) {
+    Assert(snapshot_restore(restore_file), "Fail to restore snapshot '%s'", restore_file);
+    img_size = CONFIG_MSIZE - CONFIG_PC_RESET_OFFSET;
+  }
+#endif
+
+  /* Initialize differential testing. */
+  init_difftest(diff_so_file, img_size, difftest_port);
+  if (diff_ff_pc != NULL) difftest_fast_forward(strtoull(diff_ff_pc, NULL, 0));
+
+  // if (elf_file || (ramdisk_file && appname))
+  //   init_ftracer(elf_file, ramdisk_file, appname);
+
   /* Display welcome message. */
   welcome();
 }
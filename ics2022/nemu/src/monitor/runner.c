@@ -0,0 +1,304 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Run the images listed in a manifest with a pool of worker processes.
+ * Each worker is forked from the monitor right after the arguments are
+ * parsed, and initializes memory, devices and the CPU on its own before
+ * loading its image. Thus the images are isolated from each other, and no
+ * worker shares host resources like the SDL window with another. Workers
+ * report their results through a shared mapping, and the monitor
+ * aggregates them into a JSON report.
+ *
+ * The report can be compared with a previous one as the baseline, and an
+ * image is a regression if its inst/s drops by more than the threshold.
+ */
+
+#include <instance.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+enum { JOB_WAIT, JOB_RUN, JOB_EXIT, JOB_SIGNAL };
+
+typedef struct {
+  int status;          // JOB_*
+  int exit_code;       // exit code or signal number
+  int state;           // NEMU_*, valid after the worker exits normally
+  vaddr_t halt_pc;
+  uint32_t halt_ret;
+  uint64_t nr_inst;
+  uint64_t host_time;  // unit: us
+  uint64_t exec_time;  // host time spent in cpu_exec(), unit: us
+  long max_rss;        // unit: KB
+  pid_t pid;
+} JobResult;
+
+static char **job_img = NULL;
+static int nr_job = 0;
+static JobResult *job = NULL;  // shared with workers
+static int this_job = -1;      // index of the job in a worker
+static const char *report_file = NULL;
+static uint64_t *job_baseline = NULL; // inst/s in the baseline, 0 if unknown
+static int threshold = 5;             // unit: %
+
+static void load_manifest(const char *file) {
+  FILE *fp = fopen(file, "r");
+  Assert(fp, "Can not open manifest '%s'", file);
+  int cap = 0;
+  char line[4096];
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    char *p = line + strspn(line, " \t");
+    p[strcspn(p, "\r\n")] = '\0';
+    char *end = p + strlen(p);
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t')) *(-- end) = '\0';
+    if (*p == '\0' || *p == '#') continue;
+    if (nr_job == cap) {
+      cap = (cap == 0 ? 64 : cap * 2);
+      job_img = realloc(job_img, sizeof(job_img[0]) * cap);
+      assert(job_img);
+    }
+    job_img[nr_job ++] = strdup(p);
+  }
+  fclose(fp);
+}
+
+/* Called at the exit of a worker. */
+static void job_exit() {
+  JobResult *r = &job[this_job];
+  r->state = nemu_state.state;
+  r->halt_pc = nemu_state.halt_pc;
+  r->halt_ret = nemu_state.halt_ret;
+  r->nr_inst = g_nr_guest_inst;
+  r->exec_time = nemu->timer;
+  fflush(NULL);
+}
+
+static char *job_log(int i) {
+  static char buf[4096];
+  snprintf(buf, sizeof(buf), "%s.%d.log", report_file, i);
+  return buf;
+}
+
+static bool job_good(JobResult *r) {
+  return r->status == JOB_EXIT && r->state == NEMU_END && r->halt_ret == 0;
+}
+
+static const char *job_result(JobResult *r) {
+  switch (r->status) {
+    case JOB_SIGNAL: return "crash";
+    case JOB_EXIT:
+      switch (r->state) {
+        case NEMU_END: return (r->halt_ret == 0 ? "good" : "bad");
+        case NEMU_ABORT: return "abort";
+        case NEMU_QUIT: return "quit";
+        default: return "exit";
+      }
+    default: return "unknown";
+  }
+}
+
+/* Start the next job. Return only in the worker. */
+static void job_start(int i) {
+  fflush(NULL);
+  JobResult *r = &job[i];
+  r->status = JOB_RUN;
+  r->host_time = get_time();
+  pid_t pid = fork();
+  Assert(pid >= 0, "fork() fails");
+  if (pid > 0) { r->pid = pid; return; }
+
+  /* The worker. Redirect all of its output to the log of the job. */
+  int fd = open(job_log(i), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  Assert(fd >= 0, "Can not open '%s'", job_log(i));
+  dup2(fd, STDOUT_FILENO);
+  dup2(fd, STDERR_FILENO);
+  close(fd);
+  this_job = i;
+  atexit(job_exit);
+}
+
+static uint64_t job_inst_per_sec(JobResult *r) {
+  return (r->exec_time > 0 ? r->nr_inst * 1000000 / r->exec_time : 0);
+}
+
+static bool job_regressed(int i) {
+  uint64_t base = job_baseline[i];
+  return base > 0 && job_good(&job[i]) && job_inst_per_sec(&job[i]) * 100 < base * (100 - threshold);
+}
+
+static int job_wait() {
+  int status;
+  struct rusage ru;
+  pid_t pid = wait4(-1, &status, 0, &ru);
+  assert(pid > 0);
+  uint64_t now = get_time();
+  int i;
+  for (i = 0; i < nr_job; i ++) {
+    JobResult *r = &job[i];
+    if (r->status == JOB_RUN && r->pid == pid) {
+      r->host_time = now - r->host_time;
+      r->max_rss = ru.ru_maxrss;
+      if (WIFSIGNALED(status)) {
+        r->status = JOB_SIGNAL;
+        r->exit_code = WTERMSIG(status);
+      } else {
+        r->status = JOB_EXIT;
+        r->exit_code = WEXITSTATUS(status);
+      }
+      if (job_good(r)) unlink(job_log(i));
+      printf("[%d/%d] %s %s (%" PRIu64 " instructions, %" PRIu64 " us)\n", i + 1, nr_job,
+          (job_good(r) ? ANSI_FMT("PASS", ANSI_FG_GREEN) : ANSI_FMT("FAIL", ANSI_FG_RED)),
+          job_img[i], r->nr_inst, r->host_time);
+      return i;
+    }
+  }
+  panic("unknown child %d", pid);
+}
+
+static void json_string(FILE *fp, const char *s) {
+  fputc('"', fp);
+  for (; *s; s ++) {
+    switch (*s) {
+      case '"': fputs("\\\"", fp); break;
+      case '\\': fputs("\\\\", fp); break;
+      case '\n': fputs("\\n", fp); break;
+      case '\t': fputs("\\t", fp); break;
+      default:
+        if ((unsigned char)*s < 0x20) fprintf(fp, "\\u%04x", *s);
+        else fputc(*s, fp);
+    }
+  }
+  fputc('"', fp);
+}
+
+/* Each result in a report is on its own line, see write_report(). */
+static void load_baseline(const char *file) {
+  job_baseline = calloc(nr_job, sizeof(job_baseline[0]));
+  assert(job_baseline);
+  if (file == NULL) return;
+  FILE *fp = fopen(file, "r");
+  Assert(fp, "Can not open baseline '%s'", file);
+  char line[8192];
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    char *img = strstr(line, "{\"image\": \"");
+    char *ips = strstr(line, "\"inst_per_sec\": ");
+    if (img == NULL || ips == NULL) continue;
+    img += strlen("{\"image\": \"");
+    char *end = strchr(img, '"');
+    if (end == NULL) continue;
+    *end = '\0';
+    int i;
+    for (i = 0; i < nr_job; i ++) {
+      if (strcmp(job_img[i], img) == 0) job_baseline[i] = strtoull(ips + strlen("\"inst_per_sec\": "), NULL, 10);
+    }
+  }
+  fclose(fp);
+}
+
+static int compare_baseline() {
+  int nr_regressed = 0, i;
+  for (i = 0; i < nr_job; i ++) {
+    if (job_baseline[i] == 0 || !job_good(&job[i])) continue;
+    uint64_t ips = job_inst_per_sec(&job[i]);
+    bool bad = job_regressed(i);
+    nr_regressed += bad;
+    printf("%s %s: %" PRIu64 " inst/s, baseline %" PRIu64 " inst/s (%+.1f%%)\n",
+        (bad ? ANSI_FMT("SLOW", ANSI_FG_RED) : ANSI_FMT("OK  ", ANSI_FG_GREEN)), job_img[i],
+        ips, job_baseline[i], ((double)ips / job_baseline[i] - 1) * 100);
+  }
+  return nr_regressed;
+}
+
+static int write_report(int nr_worker, uint64_t wall_time) {
+  int nr_pass = 0, i;
+  for (i = 0; i < nr_job; i ++) nr_pass += job_good(&job[i]);
+  int nr_regressed = compare_baseline();
+
+  FILE *fp = fopen(report_file, "w");
+  Assert(fp, "Can not open '%s'", report_file);
+  fprintf(fp, "{\n  \"jobs\": %d,\n  \"wall_time_us\": %" PRIu64 ",\n", nr_worker, wall_time);
+  fprintf(fp, "  \"total\": %d,\n  \"passed\": %d,\n  \"failed\": %d,\n", nr_job, nr_pass, nr_job - nr_pass);
+  fprintf(fp, "  \"threshold_percent\": %d,\n  \"regressed\": %d,\n", threshold, nr_regressed);
+  fprintf(fp, "  \"results\": [");
+  for (i = 0; i < nr_job; i ++) {
+    JobResult *r = &job[i];
+    fprintf(fp, "%s\n    {\"image\": ", (i == 0 ? "" : ","));
+    json_string(fp, job_img[i]);
+    fprintf(fp, ", \"result\": \"%s\"", job_result(r));
+    if (r->status == JOB_SIGNAL) fprintf(fp, ", \"signal\": %d", r->exit_code);
+    else fprintf(fp, ", \"exit_code\": %d, \"halt_pc\": \"" FMT_WORD "\", \"halt_ret\": %u",
+        r->exit_code, r->halt_pc, r->halt_ret);
+    fprintf(fp, ", \"instructions\": %" PRIu64 ", \"host_time_us\": %" PRIu64, r->nr_inst, r->host_time);
+    // the host time out of cpu_exec() is mostly the startup, e.g. loading the image
+    fprintf(fp, ", \"exec_time_us\": %" PRIu64 ", \"startup_us\": %" PRIu64,
+        r->exec_time, (r->host_time > r->exec_time ? r->host_time - r->exec_time : 0));
+    fprintf(fp, ", \"inst_per_sec\": %" PRIu64 ", \"max_rss_kb\": %ld", job_inst_per_sec(r), r->max_rss);
+    if (job_baseline[i] > 0) {
+      fprintf(fp, ", \"baseline_inst_per_sec\": %" PRIu64 ", \"regressed\": %s",
+          job_baseline[i], (job_regressed(i) ? "true" : "false"));
+    }
+    if (!job_good(r)) {
+      fprintf(fp, ", \"log\": ");
+      json_string(fp, job_log(i));
+    }
+    fputc('}', fp);
+  }
+  fprintf(fp, "\n  ]\n}\n");
+  fclose(fp);
+
+  printf("%d/%d passed, wall time = %" PRIu64 " us, report is written to %s\n",
+      nr_pass, nr_job, wall_time, report_file);
+  if (nr_regressed > 0) printf("%d images are slower than the baseline by more than %d%%\n", nr_regressed, threshold);
+  return nr_pass == nr_job && nr_regressed == 0 ? 0 : 1;
+}
+
+/* Run the images in `manifest` with `nr_worker` processes at most, and
+ * compare their inst/s with the report `baseline` if it is not NULL.
+ * Return the image to run in a worker, and never return in the monitor. */
+char *batch_run(const char *manifest, int nr_worker, const char *report,
+    const char *baseline, int regress_threshold) {
+  report_file = (report ? report : "nemu-report.json");
+  threshold = regress_threshold;
+  load_manifest(manifest);
+  Assert(nr_job > 0, "No image is given in manifest '%s'", manifest);
+  load_baseline(baseline);
+  if (nr_worker <= 0) nr_worker = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nr_worker > nr_job) nr_worker = nr_job;
+  Log("Run %d images with %d workers", nr_job, nr_worker);
+
+  job = mmap(NULL, sizeof(job[0]) * nr_job, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  assert(job != MAP_FAILED);
+  memset(job, 0, sizeof(job[0]) * nr_job);
+
+  uint64_t wall_time = get_time();
+  int next = 0, nr_running = 0;
+  while (next < nr_job || nr_running > 0) {
+    if (next < nr_job && nr_running < nr_worker) {
+      job_start(next);
+      if (this_job >= 0) return job_img[this_job];
+      next ++;
+      nr_running ++;
+    } else {
+      job_wait();
+      nr_running --;
+    }
+  }
+  wall_time = get_time() - wall_time;
+
+  exit(write_report(nr_worker, wall_time));
+}
@@ -0,0 +1,277 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Breakpoints are kept in a hash set keyed by pc, which is only probed
+ * after an instruction when there is any breakpoint, so they cost nothing
+ * otherwise. A breakpoint may have a condition compiled like watchpoints.
+ *
+ * Reverse execution rewinds to a checkpoint and replays the instructions
+ * after it. While replaying, breakpoints are recorded instead of stopping
+ * the machine, so that reverse-continue can find the last one hit.
+ */
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include "sdb.h"
+#include "../elfloader.h"
+
+#define NR_BP 32
+#define BP_HASH_SIZE 64 // power of 2, larger than NR_BP
+
+typedef struct
+{
+  int NO; // 0 if it is free
+  vaddr_t pc;
+  Expr *cond;
+  char cond_str[256];
+} BP;
+
+static BP bp_pool[NR_BP] = {};
+static BP *bp_hash[BP_HASH_SIZE] = {};
+int bp_nr = 0;
+
+static bool recording = false;
+static uint64_t last_hit = -1;
+
+static inline int bp_hash_idx(vaddr_t pc)
+{
+  return ((uint32_t)(pc >> 1) * 0x9e3779b1u) >> (32 - 6);
+}
+
+// linear probing
+static BP **bp_slot(vaddr_t pc)
+{
+  int i = bp_hash_idx(pc);
+  while (bp_hash[i] != NULL && bp_hash[i]->pc != pc)
+    i = (i + 1) % BP_HASH_SIZE;
+  return &bp_hash[i];
+}
+
+static void bp_rehash()
+{
+  int i;
+  memset(bp_hash, 0, sizeof(bp_hash));
+  for (i = 0; i < NR_BP; i++)
+  {
+    if (bp_pool[i].NO != 0)
+      *bp_slot(bp_pool[i].pc) = &bp_pool[i];
+  }
+}
+
+static BP* bp_alloc()
+{
+  int i;
+  for (i = 0; i < NR_BP; i++)
+  {
+    if (bp_pool[i].NO == 0)
+      return &bp_pool[i];
+  }
+  printf("no free breakpoint\n");
+  return NULL;
+}
+
+void new_bp(vaddr_t pc, char *cond)
+{
+  if (*bp_slot(pc) != NULL)
+  {
+    printf("breakpoint is already at " FMT_WORD "\n", pc);
+    return;
+  }
+  BP *b = bp_alloc();
+  if (b == NULL)
+    return;
+  if (cond != NULL && strlen(cond) >= sizeof(b->cond_str))
+  {
+    printf("condition is too long\n");
+    return;
+  }
+
+  b->cond = NULL;
+  b->cond_str[0] = '\0';
+  if (cond != NULL)
+  {
+    bool success;
+    b->cond = expr_compile(cond, &success);
+    if (!success)
+      return;
+    strcpy(b->cond_str, cond);
+  }
+  b->NO = sdb_new_no();
+  b->pc = pc;
+  *bp_slot(pc) = b;
+  bp_nr++;
+  printf("Breakpoint %d at " FMT_WORD "%s%s\n", b->NO, pc, (cond ? " if " : ""), b->cond_str);
+}
+
+/* Breakpoints inserted by GDB are numbered -1, and stop the machine quietly.
+ * A breakpoint set by sdb at the same pc is shared. */
+bool bp_insert(vaddr_t pc)
+{
+  if (*bp_slot(pc) != NULL)
+    return true;
+  BP *b = bp_alloc();
+  if (b == NULL)
+    return false;
+  b->NO = -1;
+  b->pc = pc;
+  b->cond = NULL;
+  b->cond_str[0] = '\0';
+  *bp_slot(pc) = b;
+  bp_nr++;
+  return true;
+}
+
+void bp_remove(vaddr_t pc)
+{
+  BP *b = *bp_slot(pc);
+  if (b == NULL || b->NO != -1)
+    return;
+  b->NO = 0;
+  bp_nr--;
+  bp_rehash();
+}
+
+// whether the stop at `pc` is caused by a breakpoint
+bool bp_inserted(vaddr_t pc)
+{
+  return *bp_slot(pc) != NULL;
+}
+
+bool free_bp(int no)
+{
+  int i;
+  for (i = 0; i < NR_BP; i++)
+  {
+    BP *b = &bp_pool[i];
+    if (no > 0 && b->NO == no)
+    {
+      if (b->cond)
+        expr_free(b->cond);
+      b->NO = 0;
+      bp_nr--;
+      bp_rehash();
+      return true;
+    }
+  }
+  return false;
+}
+
+void print_bp()
+{
+  int i;
+  if (bp_nr == 0)
+  {
+    printf("no breakpoint\n");
+    return;
+  }
+  printf("%-4s %-18s %s\n", "Num", "Address", "Condition");
+  for (i = 0; i < NR_BP; i++)
+  {
+    BP *b = &bp_pool[i];
+    if (b->NO > 0)
+      printf("%-4d " FMT_WORD "         %s\n", b->NO, b->pc, b->cond_str);
+  }
+}
+
+/* Called with the pc of the next instruction when bp_nr > 0. */
+void bp_check(vaddr_t pc)
+{
+  BP *b = *bp_slot(pc);
+  if (likely(b == NULL))
+    return;
+  if (b->cond)
+  {
+    bool success;
+    word_t val = expr_eval(b->cond, &success);
+    if (success && val == 0)
+      return;
+  }
+  if (recording)
+  {
+    last_hit = g_nr_guest_inst;
+    return;
+  }
+  if (b->NO > 0)
+  {
+    vaddr_t start;
+    const char *func = elf_sym_lookup(pc, &start);
+    printf("\nBreakpoint %d at " FMT_WORD, b->NO, pc);
+    if (func != NULL)
+      printf(" <%s+%d>", func, (int)(pc - start));
+    printf("\n");
+  }
+  if (nemu_state.state == NEMU_RUNNING)
+    nemu_state.state = NEMU_STOP;
+}
+
+#ifdef CONFIG_REVERSE_EXEC
+// replay quietly until `nr_inst` instructions are executed
+static void replay_to(uint64_t nr_inst)
+{
+  recording = true;
+  wp_pause(true);
+  cpu_replay(nr_inst - g_nr_guest_inst);
+  wp_pause(false);
+  recording = false;
+}
+
+static void print_where()
+{
+  printf(FMT_WORD " after %" PRIu64 " instructions\n", cpu.pc, g_nr_guest_inst);
+}
+
+void reverse_step(uint64_t n)
+{
+  uint64_t target = (n > g_nr_guest_inst ? 0 : g_nr_guest_inst - n);
+  if (target < checkpoint_oldest() || !checkpoint_rewind(target))
+  {
+    printf("No more reverse-execution history.\n");
+    target = checkpoint_oldest();
+    if (target == -1 || !checkpoint_rewind(target))
+      return;
+  }
+  replay_to(target);
+  print_where();
+}
+
+void reverse_continue()
+{
+  uint64_t end = g_nr_guest_inst; // search the hits before `end`
+  while (end > 0 && checkpoint_rewind(end - 1))
+  {
+    uint64_t start = g_nr_guest_inst;
+    // the hits in [start, end - 1]
+    recording = true;
+    last_hit = -1;
+    bp_check(cpu.pc);
+    replay_to(end - 1);
+    if (last_hit != -1)
+    {
+      checkpoint_rewind(last_hit);
+      replay_to(last_hit);
+      printf("\nBreakpoint at " FMT_WORD "\n", cpu.pc);
+      print_where();
+      return;
+    }
+    end = start;
+  }
+  printf("No more reverse-execution history.\n");
+  if (checkpoint_oldest() != -1 && checkpoint_rewind(checkpoint_oldest()))
+  {
+    replay_to(g_nr_guest_inst);
+    print_where();
+  }
+}
+#endif
@@ -14,6 +14,8 @@
  ***************************************************************************************/
 
 #include <isa.h>
+#include <memory/paddr.h>
+#include "sdb.h"
 
 /* We use the POSIX regex functions to process regular expressions.
  * Type 'man regex' for more information about POSIX regex functions.
@@ -59,8 +61,8 @@ static struct rule
     {"\\(", TK_LEFT_BRACE},
     {"\\)", TK_RIGHT_BRACE},
     {"\\|\\|", TK_OR},              // OR
-    {"0x[0-9a-f]+", TK_HEX},        // hex nums
-    {"\\$[a-ehilpx]{2,3}", TK_REG}, // the registers
+    {"0x[0-9a-fA-F]+", TK_HEX},     // hex nums
+    {"\\$[$a-z0-9]+", TK_REG},      // the registers, e.g. $a0, $pc and $$0
     {"[0-9]+", TK_DECI},            // decimal nums
     {"[0-9]{1,10}", TK_OCT},
     {"[a-zA-Z_][a-zA-Z0-9_]*", TK_VAR}, // variable
@@ -96,7 +98,9 @@ typedef struct token
   char str[32];
 } Token;
 
-static Token tokens[32] __attribute__((used)) = {};
+#define NR_TOKEN 32
+
+static Token tokens[NR_TOKEN] __attribute__((used)) = {};
 static int nr_token __attribute__((used)) = 0;
 
 static bool make_token(char *e)
@@ -116,79 +120,21 @@ static bool make_token(char *e)
         char *substr_start = e + position;
         int substr_len = pmatch.rm_eo;
 
-        Log("match rules[%d] = \"%s\" at position %d with len %d: %.*s",
-            i, rules[i].regex, position, substr_len, substr_len, substr_start);
         position += substr_len;
 
-        switch (rules[i].token_type)
+        if (rules[i].token_type == TK_SPACE)
         {
-        case TK_LEFT_BRACE:
-          tokens[nr_token].type = TK_LEFT_BRACE;
-          strcpy(tokens[nr_token].str, "(");
-          break;
-        case TK_RIGHT_BRACE:
-          tokens[nr_token].type = TK_RIGHT_BRACE;
-          strcpy(tokens[nr_token].str, ")");
-          break;
-        case TK_DIVISION:
-          tokens[nr_token].type = TK_DIVISION;
-          strcpy(tokens[nr_token].str, "/");
-          break;
-        case TK_ADD:
-          tokens[nr_token].type = TK_ADD;
-          strcpy(tokens[nr_token].str, "+");
-          break;
-        case TK_MULTIPLY:
-          tokens[nr_token].type = TK_MULTIPLY;
-          strcpy(tokens[nr_token].str, "*");
-          break;
-        case TK_MINUS:
-          tokens[nr_token].type = TK_MINUS;
-          strcpy(tokens[nr_token].str, "-");
-          break;
-        case TK_EQ:
-          tokens[nr_token].type = TK_EQ;
-          strcpy(tokens[nr_token].str, "==");
-          break;
-        case TK_NTEQ:
-          tokens[nr_token].type = TK_NTEQ;
-          strcpy(tokens[nr_token].str, "!=");
-          break;
-        case TK_AND:
-          tokens[nr_token].type = TK_AND;
-          strcpy(tokens[nr_token].str, "&&");
-          break;
-        case TK_OR:
-          tokens[nr_token].type = TK_OR;
-          strcpy(tokens[nr_token].str, "||");
-          break;
-        case TK_HEX:
-          tokens[nr_token].type = TK_HEX;
-          break;
-        case TK_DECI:
-          tokens[nr_token].type = TK_DECI;
-          strncpy(tokens[nr_token].str, &e[position - substr_len], substr_len);
-          break;
-        case TK_REG:
-          tokens[nr_token].type = TK_REG;
-          strncpy(tokens[nr_token].str, &e[position - substr_len], substr_len);
-          break;
-        case TK_OCT:
-          tokens[nr_token].type = TK_OCT;
-          strncpy(tokens[nr_token].str, &e[position - substr_len], substr_len);
-          break;
-        case TK_VAR:
-          tokens[nr_token].type = TK_VAR;
-          strncpy(tokens[nr_token].str, &e[position - substr_len], substr_len);
-          break;
-        case TK_NOT:
-          tokens[nr_token].type = TK_NOT;
-          strcpy(tokens[nr_token].str, "!");
-          break;
-        default:
-          nr_token--;
           break;
         }
+        if (nr_token == NR_TOKEN || substr_len >= sizeof(tokens[0].str))
+        {
+          printf("expression is too long\n");
+          return false;
+        }
+        // numbers, registers and variables need the text, and others just keep it for messages
+        tokens[nr_token].type = rules[i].token_type;
+        memcpy(tokens[nr_token].str, substr_start, substr_len);
+        tokens[nr_token].str[substr_len] = '\0';
         nr_token++;
         break;
       }
@@ -204,265 +150,255 @@ static bool make_token(char *e)
   return true;
 }
 
-int find_matched_brace_idx(int p, int q)
+/* Expressions are compiled into a program of a stack machine in postfix
+ * order, so that watchpoints and conditions evaluated at every instruction
+ * do not go through the regular expressions and the parser again.
+ */
+
+enum
 {
+  OP_NUM,   // push val
+  OP_REG,   // push the register numbered val, see isa_gdb_reg()
+  OP_DEREF, // pop an address, push the word at it
+  OP_NEG,
+  OP_NOT,
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_EQ,
+  OP_NE,
+  OP_AND,
+  OP_OR,
+};
 
-  // for (int i=p ; i <= q; i++) {
-  //   printf("  %s  ", tokens[i].str);
-  // }
+typedef struct
+{
+  int op;
+  word_t val;
+} ExprInst;
 
-  int matched = 1;
-  if (tokens[p].type != TK_LEFT_BRACE)
-  {
-    return p;
-  }
+struct Expr
+{
+  int n;
+  ExprInst code[NR_TOKEN];
+};
 
-  for( ++p; p <= q ; p++ ) {
-    // printf(" matched %d \n", matched);
-    if ( matched == 0 ) {
-      // printf("the matched position is %d\n", p);
-      return p;
-    }
+static int pos = 0; // the next token to compile
 
-    if (tokens[p].type == TK_LEFT_BRACE ) {
-      matched = matched + 1;
-    } else if (tokens[p].type == TK_RIGHT_BRACE) {
-      matched = matched - 1;
-    }
-  }
-  // printf("not found the matched position\n");
-  return -1;
+static bool emit(Expr *e, int op, word_t val)
+{
+  assert(e->n < NR_TOKEN);
+  ExprInst *inst = &e->code[e->n++];
+  inst->op = op;
+  inst->val = val;
+  return true;
 }
 
-int find_matched_brace_postion(int p, int q)
+static bool compile_binary(Expr *e, int min_prec);
+
+// unary operators, numbers, registers and parentheses
+static bool compile_unary(Expr *e)
 {
-  if (tokens[p].type != TK_LEFT_BRACE)
+  if (pos >= nr_token)
   {
-    return p;
+    printf("expression is incomplete\n");
+    return false;
   }
-
-  for( ; q >= p ; q--) {
-    if (tokens[q].type == TK_RIGHT_BRACE) {
-      return q;
-    }
-  }
-  return -1;
-}
-int get_next_operation_idx(int p, int q)
-{ 
-  // for (int i=p ; i <= q; i++) {
-  //   printf("  %s  ", tokens[i].str);
-  // }
-  int preOperation = -1;
-
-  if( tokens[p].type == TK_LEFT_BRACE) {
-    p = find_matched_brace_idx(p, q);
-    if ( p < 0) {
-      return -1;
+  Token *t = &tokens[pos++];
+  switch (t->type)
+  {
+  case TK_MINUS:
+    return compile_unary(e) && emit(e, OP_NEG, 0);
+  case TK_NOT:
+    return compile_unary(e) && emit(e, OP_NOT, 0);
+  case TK_MULTIPLY:
+    return compile_unary(e) && emit(e, OP_DEREF, 0);
+  case TK_HEX:
+    return emit(e, OP_NUM, strtoull(t->str, NULL, 16));
+  case TK_DECI:
+    return emit(e, OP_NUM, strtoull(t->str, NULL, 10));
+  case TK_REG:
+  {
+    // resolved once here, while the value is read from the current hart
+    int no = isa_reg_str2no(t->str + 1);
+    if (no < 0)
+    {
+      printf("unknown register '%s'\n", t->str);
+      return false;
     }
-    p++;
+    return emit(e, OP_REG, no);
   }
-  
-
-  for( ; p <= q ; p++) {
-    // printf("find next one: %d - %d\n", p, q);
-    if( tokens[p].type < TK_HEX ) {
-      preOperation = p; 
-      break;
+  case TK_LEFT_BRACE:
+    if (!compile_binary(e, 1))
+      return false;
+    if (pos >= nr_token || tokens[pos].type != TK_RIGHT_BRACE)
+    {
+      printf("')' is expected\n");
+      return false;
     }
+    pos++;
+    return true;
+  default:
+    printf("unexpected '%s'\n", t->str);
+    return false;
   }
+}
 
-  for (; p <= q; p++)
+static int precedence(int type)
+{
+  switch (type)
   {
-    // printf("token type: %d\n", tokens[p].type);
-    switch (tokens[p].type)
-    {
-    case TK_NOT:
-      continue;
-    case TK_HEX:
-      continue;
-    case TK_DECI:
-      continue;
-    case TK_REG:
-      continue;
-    case TK_OCT:
-      continue;
-    case TK_VAR:
-      continue;
-    case TK_SPACE:
-      continue;
-    case TK_LEFT_BRACE:
-      p = find_matched_brace_idx(p, q);
-      continue;
-    case TK_OR:
-      preOperation = p;
-      continue;
-    case TK_AND:
-      if (tokens[preOperation].type < TK_AND)
-      {
-        preOperation = p;
-      }
-      continue;
-    case TK_NTEQ:
-      if (tokens[preOperation].type < TK_NTEQ)
-      {
-        preOperation = p;
-      }
-      continue;
-    case TK_EQ:
-      if (tokens[preOperation].type < TK_EQ)
-      {
-        preOperation = p;
-      }
-      continue;
-    case TK_ADD:
-      if (tokens[preOperation].type <= TK_ADD)
-      {
-        preOperation = p;
-      }
-      continue;
-    case TK_MINUS:
-      if (tokens[preOperation].type < TK_MINUS)
-      {
-        preOperation = p;
-      }
-      continue;
-    case TK_DIVISION:
-      if ( (tokens[preOperation].type <= TK_MULTIPLY || tokens[preOperation].type <= TK_DIVISION))
-      {
-        preOperation = p;
-      }
-      continue;
-    case TK_MULTIPLY:
-      if ((tokens[preOperation].type <= TK_MULTIPLY || tokens[preOperation].type <= TK_DIVISION) )
-      {
-        preOperation = p;
-      }
-      continue;
-    default:
-      continue;
-    }
+  case TK_OR: return 1;
+  case TK_AND: return 2;
+  case TK_EQ: case TK_NTEQ: return 3;
+  case TK_ADD: case TK_MINUS: return 4;
+  case TK_MULTIPLY: case TK_DIVISION: return 5;
+  default: return 0;
   }
-  return preOperation;
 }
 
-bool valid_parentheses(int start, int end)
+// binary operators with precedence not lower than `min_prec`, all left associative
+static bool compile_binary(Expr *e, int min_prec)
 {
-  int top = -1;
-  for (int i = start; i <= end; i++)
+  if (!compile_unary(e))
+    return false;
+  while (pos < nr_token && precedence(tokens[pos].type) >= min_prec)
   {
-    if (tokens[i].type == TK_LEFT_BRACE)
-    {
-      ++top;
-    }
-    else if (tokens[i].type == TK_RIGHT_BRACE)
+    int type = tokens[pos++].type;
+    if (!compile_binary(e, precedence(type) + 1))
+      return false;
+    int op;
+    switch (type)
     {
-      if (top == -1)
-      {
-        return false;
-      }
-      else
-      {
-        top--;
-      }
+    case TK_OR: op = OP_OR; break;
+    case TK_AND: op = OP_AND; break;
+    case TK_EQ: op = OP_EQ; break;
+    case TK_NTEQ: op = OP_NE; break;
+    case TK_ADD: op = OP_ADD; break;
+    case TK_MINUS: op = OP_SUB; break;
+    case TK_MULTIPLY: op = OP_MUL; break;
+    default: op = OP_DIV; break;
     }
+    emit(e, op, 0);
   }
-  return top == -1;
+  return true;
 }
 
-int eval(int p, int q, bool *success)
+Expr *expr_compile(char *e, bool *success)
 {
-
-  if (!valid_parentheses(p,q)) {
-    // printf("invalid parentheses\n");
-    assert(0);
+  *success = false;
+  if (!make_token(e))
+    return NULL;
+  if (nr_token == 0)
+  {
+    printf("empty expression\n");
+    return NULL;
   }
 
-  if ( ! *success) {
-    assert(0);
+  Expr *ex = malloc(sizeof(*ex));
+  assert(ex);
+  ex->n = 0;
+  pos = 0;
+  if (!compile_binary(ex, 1) || pos != nr_token)
+  {
+    if (pos != nr_token)
+      printf("unexpected '%s'\n", tokens[pos].str);
+    free(ex);
+    return NULL;
   }
-  // printf("p=%d, q=%d\n", p, q);
-  assert(p <= q);
+  *success = true;
+  return ex;
+}
+
+void expr_free(Expr *e)
+{
+  free(e);
+}
 
-  if (p == q)
+// the first `n` instructions of the program
+static word_t expr_run(const Expr *e, int n, bool *success)
+{
+  word_t stack[NR_TOKEN];
+  int top = 0, i;
+  *success = false;
+  for (i = 0; i < n; i++)
   {
-    switch (tokens[p].type)
+    const ExprInst *inst = &e->code[i];
+    if (inst->op == OP_NUM || inst->op == OP_REG)
     {
-    case TK_DECI:
-      return strtol(tokens[p].str, NULL, 10);
-    case TK_HEX:
-      return strtol(tokens[p].str, NULL, 16);
-    case TK_REG:
-      // TODO: add register here
-      return 1;
-    default:
-      assert(0);
-    }
-  }
-  else if ( tokens[p].type == TK_LEFT_BRACE && tokens[q].type == TK_RIGHT_BRACE && find_matched_brace_idx(p, q) == q ) 
-  {
-    // printf("in two braces\n");
-    if( valid_parentheses(p, q)) {
-      return eval(p + 1, q - 1, success);
-    } else {
-      // printf("invalid parentheses\n");
-      assert(0);
+      stack[top++] = (inst->op == OP_NUM ? inst->val : *isa_gdb_reg(inst->val));
+      continue;
     }
-  }
-  else
-  {
-    int operator;
-    if (q - p == 1)
+    word_t *a = &stack[top - 1];
+    if (inst->op <= OP_NOT)
     {
-      if (tokens[p].type == TK_MINUS)
+      switch (inst->op)
       {
-        return -eval(q, q, success);
-      }
-      else if (tokens[p].type == TK_NOT)
-      {
-        return !eval(p + 1, q, success);
+      case OP_DEREF:
+        if (!in_pmem(*a) || !in_pmem(*a + 3))
+        {
+          printf("cannot access memory at address " FMT_WORD "\n", *a);
+          return 0;
+        }
+        *a = paddr_read(*a, 4);
+        break;
+      case OP_NEG: *a = -*a; break;
+      default: *a = !*a; break;
       }
+      continue;
     }
-
-    operator= get_next_operation_idx(p, q);
-    if( operator < 0 ) {
-      assert(0);
-    }
-
-    int leftOps = eval(p, operator- 1, success);
-    int rightOPs = eval(operator+ 1, q, success);
-    switch (tokens[operator].type)
+    word_t b = stack[--top];
+    a = &stack[top - 1];
+    switch (inst->op)
     {
-    case TK_ADD:
-      return leftOps + rightOPs;
-    case TK_MINUS:
-      return leftOps - rightOPs;
-    case TK_MULTIPLY:
-      return leftOps * rightOPs;
-    case TK_DIVISION:
-      return leftOps / rightOPs;
-    case TK_EQ:
-      return (leftOps == rightOPs);
-    case TK_NTEQ:
-      return (leftOps != rightOPs);
-    case TK_AND:
-      return (leftOps && rightOPs);
-    case TK_OR:
-      return (leftOps || rightOPs);
-    default:
-      assert(0);
+    case OP_DIV:
+      if (b == 0)
+      {
+        printf("division by zero\n");
+        return 0;
+      }
+      *a /= b;
+      break;
+    case OP_ADD: *a += b; break;
+    case OP_SUB: *a -= b; break;
+    case OP_MUL: *a *= b; break;
+    case OP_EQ: *a = (*a == b); break;
+    case OP_NE: *a = (*a != b); break;
+    case OP_AND: *a = (*a && b); break;
+    default: *a = (*a || b); break;
     }
   }
+  *success = true;
+  return stack[0];
 }
 
-word_t expr(char *e, bool *success)
+word_t expr_eval(const Expr *e, bool *success)
 {
-  if (!make_token(e))
+  return expr_run(e, e->n, success);
+}
+
+bool expr_watch_addr(const Expr *e, paddr_t *addr)
+{
+  int i;
+  if (e->code[e->n - 1].op != OP_DEREF)
+    return false;
+  for (i = 0; i < e->n - 1; i++)
   {
-    assert(0);
+    if (e->code[i].op == OP_REG || e->code[i].op == OP_DEREF)
+      return false;
   }
+  bool success;
+  *addr = expr_run(e, e->n - 1, &success);
+  return success && in_pmem(*addr) && in_pmem(*addr + 3);
+}
 
-  *success = true;
-
-  return eval(0, nr_token-1, success);
+word_t expr(char *e, bool *success)
+{
+  Expr *ex = expr_compile(e, success);
+  if (!*success)
+    return 0;
+  word_t ret = expr_eval(ex, success);
+  expr_free(ex);
+  return ret;
 }
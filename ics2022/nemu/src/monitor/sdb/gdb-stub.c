@@ -0,0 +1,368 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* A stub of the GDB remote serial protocol, serving one client on a local
+ * port instead of the readline loop of sdb. Software breakpoints share the
+ * hash set of sdb breakpoints, so they cost nothing when none is inserted.
+ * Memory accesses are restricted to pmem to avoid side effects of MMIO.
+ * Since the target keeps running until it stops by itself, an interrupt
+ * from GDB is polled every POLL_INTERVAL instructions.
+ */
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <memory/paddr.h>
+#include "sdb.h"
+#include "../../../tools/qemu-diff/include/protocol.h"
+
+#define PKT_SIZE 4096
+// instructions executed between two polls of the interrupt from GDB
+#define POLL_INTERVAL 65536
+
+static struct gdb_conn *conn = NULL;
+static bool interrupted = false;
+static char reply[PKT_SIZE * 2 + 16];
+
+static void send_str(const char *s)
+{
+  gdb_send(conn, (const uint8_t *)s, strlen(s));
+}
+
+static char *put_hex(char *p, const uint8_t *buf, int len)
+{
+  int i;
+  for (i = 0; i < len; i++)
+  {
+    *p++ = hex_encode(buf[i] >> 4);
+    *p++ = hex_encode(buf[i] & 0xf);
+  }
+  *p = '\0';
+  return p;
+}
+
+static bool get_hex(const char *p, uint8_t *buf, int len)
+{
+  int i;
+  for (i = 0; i < len; i++)
+  {
+    uint16_t b = gdb_decode_hex(p[2 * i], p[2 * i + 1]);
+    if (b == UINT16_MAX)
+      return false;
+    buf[i] = b;
+  }
+  return true;
+}
+
+static bool mem_ok(word_t addr, word_t len)
+{
+  return len == 0 || (in_pmem(addr) && in_pmem(addr + len - 1) && addr + len - 1 >= addr);
+}
+
+static void mem_read(word_t addr, uint8_t *buf, int len)
+{
+  int i;
+  for (i = 0; i < len; i++)
+    buf[i] = paddr_read(addr + i, 1);
+}
+
+// the data also go to the undo logs and REF of difftest
+static void mem_write(word_t addr, const uint8_t *buf, int len)
+{
+  paddr_write_debug(addr, buf, len);
+}
+
+// registers are sent in the target byte order, i.e. little endian
+static char *put_reg(char *p, word_t val)
+{
+  return put_hex(p, (uint8_t *)&val, sizeof(val));
+}
+
+static void stop_reply()
+{
+  switch (nemu_state.state)
+  {
+  case NEMU_END:
+    sprintf(reply, "W%02x", nemu_state.halt_ret & 0xff);
+    break;
+  case NEMU_ABORT:
+    strcpy(reply, "X06"); // SIGABRT
+    break;
+  default:
+    strcpy(reply, interrupted ? "S02" : "S05"); // SIGINT or SIGTRAP
+    break;
+  }
+}
+
+/* Continue in slices of POLL_INTERVAL instructions, and stop when GDB sends
+ * an interrupt (Ctrl-C) between them. A slice which stops early, or ends
+ * right at a breakpoint, stops the target. */
+static void resume(bool step)
+{
+  interrupted = false;
+  if (step)
+    cpu_exec(1);
+  else
+  {
+    while (true)
+    {
+      uint64_t start = g_nr_guest_inst;
+      cpu_exec(POLL_INTERVAL);
+      if (nemu_state.state != NEMU_STOP || g_nr_guest_inst - start < POLL_INTERVAL || bp_inserted(cpu.pc))
+        break;
+      if (gdb_poll_interrupt(conn))
+      {
+        interrupted = true;
+        break;
+      }
+    }
+  }
+  stop_reply();
+}
+
+// vCont;ACTION[:THREAD]..., only the first action matters with a single thread
+static bool vcont(const char *p)
+{
+  if (strcmp(p, "?") == 0)
+  {
+    strcpy(reply, "vCont;c;C;s;S");
+    return true;
+  }
+  if (p[0] != ';')
+    return false;
+  switch (p[1])
+  {
+  case 'c': case 'C': resume(false); return true;
+  case 's': case 'S': resume(true); return true;
+  }
+  return false;
+}
+
+static void xfer_tdesc(const char *annex, word_t off, word_t len)
+{
+  if (strcmp(annex, "target.xml") != 0)
+  {
+    strcpy(reply, "E00");
+    return;
+  }
+  const char *xml = isa_gdb_tdesc();
+  word_t size = strlen(xml);
+  if (off >= size)
+  {
+    strcpy(reply, "l");
+    return;
+  }
+  if (len > PKT_SIZE - 1)
+    len = PKT_SIZE - 1;
+  if (len > size - off)
+    len = size - off;
+  reply[0] = (off + len < size ? 'm' : 'l');
+  memcpy(reply + 1, xml + off, len);
+  reply[len + 1] = '\0';
+}
+
+static void query(char *p)
+{
+  char annex[64];
+  unsigned long off, len;
+  if (strncmp(p, "qSupported", 10) == 0)
+    sprintf(reply, "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+;vContSupported+;binary-upload+", PKT_SIZE);
+  else if (sscanf(p, "qXfer:features:read:%63[^:]:%lx,%lx", annex, &off, &len) == 3)
+    xfer_tdesc(annex, off, len);
+  else if (strcmp(p, "qAttached") == 0)
+    strcpy(reply, "1");
+  else if (strcmp(p, "qC") == 0)
+    strcpy(reply, "QC1");
+  else if (strcmp(p, "qfThreadInfo") == 0)
+    strcpy(reply, "m1");
+  else if (strcmp(p, "qsThreadInfo") == 0)
+    strcpy(reply, "l");
+}
+
+static void read_mem(char *p)
+{
+  unsigned long addr, len;
+  uint8_t buf[PKT_SIZE];
+  if (sscanf(p + 1, "%lx,%lx", &addr, &len) != 2 || !mem_ok(addr, len))
+  {
+    strcpy(reply, "E01");
+    return;
+  }
+  if (len > PKT_SIZE / 2 - 1)
+    len = PKT_SIZE / 2 - 1;
+  mem_read(addr, buf, len);
+  if (p[0] == 'm')
+  {
+    put_hex(reply, buf, len);
+    return;
+  }
+  // binary data of 'x' are escaped and prefixed with 'b'
+  reply[0] = 'b';
+  size_t size = gdb_escape_binary((uint8_t *)reply + 1, buf, len) + 1;
+  gdb_send(conn, (const uint8_t *)reply, size);
+  reply[0] = '\0';
+}
+
+// the binary data of 'X' are unescaped by gdb_recv(), and may contain '\0'
+static void write_mem(char *p, size_t size)
+{
+  unsigned long addr, len;
+  uint8_t buf[PKT_SIZE];
+  int n = 0;
+  if (sscanf(p + 1, "%lx,%lx:%n", &addr, &len, &n) != 2 || n == 0 ||
+      len > sizeof(buf) || !mem_ok(addr, len))
+  {
+    strcpy(reply, "E01");
+    return;
+  }
+  char *data = p + 1 + n;
+  if (p[0] == 'M' ? !get_hex(data, buf, len) : size - (data - p) < len)
+  {
+    strcpy(reply, "E01");
+    return;
+  }
+  mem_write(addr, (p[0] == 'M' ? buf : (uint8_t *)data), len);
+  strcpy(reply, "OK");
+}
+
+static void access_reg(char *p)
+{
+  unsigned long no;
+  word_t *r;
+  char *q = reply;
+  int n = 0;
+  switch (p[0])
+  {
+  case 'g':
+    for (no = 0; (r = isa_gdb_reg(no)) != NULL; no++)
+      q = put_reg(q, *r);
+    return;
+  case 'G':
+    for (no = 0, q = p + 1; (r = isa_gdb_reg(no)) != NULL && strlen(q) >= 2 * sizeof(word_t); no++)
+    {
+      get_hex(q, (uint8_t *)r, sizeof(word_t));
+      q += 2 * sizeof(word_t);
+    }
+    strcpy(reply, "OK");
+    return;
+  case 'p':
+    if (sscanf(p, "p%lx", &no) == 1 && (r = isa_gdb_reg(no)) != NULL)
+      put_reg(reply, *r);
+    else
+      strcpy(reply, "E01");
+    return;
+  default:
+    if (sscanf(p, "P%lx=%n", &no, &n) == 1 && n > 0 && (r = isa_gdb_reg(no)) != NULL &&
+        get_hex(p + n, (uint8_t *)r, sizeof(word_t)))
+      strcpy(reply, "OK");
+    else
+      strcpy(reply, "E01");
+    return;
+  }
+}
+
+/* Handle a packet, return false if the session ends. An empty reply
+ * means the packet is not supported. */
+static bool handle(char *p, size_t size)
+{
+  unsigned long type, addr;
+  reply[0] = '\0';
+
+  switch (p[0])
+  {
+  case '?':
+    stop_reply();
+    break;
+  case 'q':
+    query(p);
+    break;
+  case 'Q':
+    if (strcmp(p, "QStartNoAckMode") == 0)
+    {
+      send_str("OK");
+      gdb_set_ack(conn, false);
+      return true;
+    }
+    break;
+  case 'H':
+  case 'T':
+    strcpy(reply, "OK"); // there is only one thread
+    break;
+  case 'g': case 'G': case 'p': case 'P':
+    access_reg(p);
+    break;
+  case 'm':
+  case 'x':
+    read_mem(p);
+    if (p[0] == 'x' && reply[0] == '\0')
+      return true; // already sent
+    break;
+  case 'M':
+  case 'X':
+    write_mem(p, size);
+    break;
+  case 'c':
+  case 's':
+    if (sscanf(p + 1, "%lx", &addr) == 1)
+      cpu.pc = addr;
+    resume(p[0] == 's');
+    break;
+  case 'v':
+    if (strncmp(p, "vCont", 5) == 0 && !vcont(p + 5))
+      strcpy(reply, "E01");
+    break;
+  case 'Z':
+  case 'z':
+    // software (0) and hardware (1) breakpoints are the same here
+    if (sscanf(p + 1, "%lx,%lx", &type, &addr) != 2 || type > 1)
+      break;
+    if (p[0] == 'Z' && !bp_insert(addr))
+      strcpy(reply, "E01");
+    else
+    {
+      if (p[0] == 'z')
+        bp_remove(addr);
+      strcpy(reply, "OK");
+    }
+    break;
+  case 'D':
+    send_str("OK");
+    return false;
+  case 'k':
+    nemu_state.state = NEMU_QUIT;
+    return false;
+  }
+  send_str(reply);
+  return true;
+}
+
+void gdb_mainloop(int port)
+{
+  printf("Waiting for GDB to connect on port %d\n", port);
+  conn = gdb_begin_server("127.0.0.1", port);
+  bool run = true;
+  while (run)
+  {
+    size_t size;
+    char *p = (char *)gdb_recv(conn, &size);
+    run = handle(p, size);
+    free(p);
+  }
+  gdb_end(conn);
+  conn = NULL;
+
+  // the program keeps running after GDB detaches
+  if (nemu_state.state == NEMU_STOP)
+    cpu_exec(-1);
+}
@@ -16,6 +16,7 @@
 #include <isa.h>
 #include <string.h>
 #include <cpu/cpu.h>
+#include <cpu/difftest.h>
 #include <memory/paddr.h>
 #include <readline/readline.h>
 #include <readline/history.h>
@@ -23,6 +24,7 @@
 #include "../ftrace.h"
 
 static int is_batch_mode = false;
+static int gdb_port = 0;
 
 static inline bool in_pmem(paddr_t addr);
 word_t paddr_read(paddr_t addr, int len);
@@ -69,6 +71,14 @@ static int cmd_p(char *args);
 static int cmd_info(char *args);
 static int cmd_w(char *args);
 static int cmd_d(char *args);
+static int cmd_b(char *args);
+static int cmd_rsi(char *args);
+static int cmd_rc(char *args);
+static int cmd_detach(char *args);
+static int cmd_attach(char *args);
+static int cmd_save(char *args);
+static int cmd_load(char *args);
+static int cmd_trace(char *args);
 
 static struct
 {
@@ -81,11 +91,21 @@ static struct
     {"q", "Exit NEMU", cmd_q},
     {"si", "Step Execute", cmd_si},
     {"p", "Evaluate a Math", cmd_p},
-    {"info", "Print Register or WatchPoint Information", cmd_info},
+    {"info", "Print Register, WatchPoint, BreakPoint or Performance Counter Information", cmd_info},
     {"w", "Set WatchPoint", cmd_w},
-    {"d", "delete WatchPoint", cmd_d}, 
+    {"b", "Set BreakPoint: b ADDR [if COND]", cmd_b},
+    {"d", "delete WatchPoint or BreakPoint", cmd_d}, 
+    {"reverse-step", "Step back N instructions", cmd_rsi},
+    {"rsi", "Step back N instructions", cmd_rsi},
+    {"reverse-continue", "Run backward to the previous BreakPoint", cmd_rc},
+    {"rc", "Run backward to the previous BreakPoint", cmd_rc},
     {"x", "Scan Memory", cmd_scan_memory},
     {"s", "Print Call Stack", cmd_s},
+    {"detach", "Stop stepping DiffTest with the reference design", cmd_detach},
+    {"attach", "Let the reference design catch up and resume DiffTest", cmd_attach},
+    {"save", "Save a snapshot of the machine state to a file", cmd_save},
+    {"load", "Restore the machine state from a snapshot file", cmd_load},
+    {"trace", "Trace memory or device accesses: trace [mem LOW HIGH | dev NAME | off]", cmd_trace},
     /* TODO: Add more commands */
 
 };
@@ -111,7 +131,73 @@ static int cmd_d(char *args) {
   }
 
   int num = atoi(args);
-  free_wp(num);
+  if (!free_wp(num) && !free_bp(num))
+    printf("no watchpoint or breakpoint number %d\n", num);
+  return 0;
+}
+
+int sdb_new_no()
+{
+  static int next_no = 1;
+  return next_no++;
+}
+
+static int cmd_b(char *args)
+{
+  if (args == NULL)
+  {
+    printf("invalid arguments: b ADDR [if COND] \n");
+    return 0;
+  }
+#ifdef CONFIG_BREAKPOINT
+  char *cond = strstr(args, " if ");
+  if (cond != NULL)
+  {
+    *cond = '\0';
+    cond += 4;
+  }
+  bool success;
+  vaddr_t pc;
+  // a function name, or an expression of the address
+  if (!elf_sym_addr(args, &pc))
+    pc = expr(args, &success);
+  else
+    success = true;
+  if (!success)
+  {
+    printf("invalid address %s\n", args);
+    return 0;
+  }
+  new_bp(pc, cond);
+#else
+  printf("breakpoint is not enabled\n");
+#endif
+  return 0;
+}
+
+static int cmd_rsi(char *args)
+{
+#ifdef CONFIG_REVERSE_EXEC
+  int n = (args == NULL ? 1 : atoi(args));
+  if (n <= 0)
+  {
+    printf("illegal step %d\n", n);
+    return 0;
+  }
+  reverse_step(n);
+#else
+  printf("reverse execution is not enabled\n");
+#endif
+  return 0;
+}
+
+static int cmd_rc(char *args)
+{
+#ifdef CONFIG_REVERSE_EXEC
+  reverse_continue();
+#else
+  printf("reverse execution is not enabled\n");
+#endif
   return 0;
 }
 
@@ -127,7 +213,7 @@ static int cmd_p(char *args)
   word_t res = expr(args, &success);
   if (success)
   {
-    printf("%d\n", res);
+    printf("%ld\n", (long)(sword_t)res);
   }
   
   return 0;
@@ -183,7 +269,7 @@ static int cmd_scan_memory(char *args)
       break;
     }
     word_t var = paddr_read((paddr_t)addr, 4);
-    printf("0x%08x\n", var);
+    printf("0x%08x\n", (uint32_t)var);
     addr += 4;
   }
 
@@ -216,11 +302,93 @@ static int cmd_s(char *args)
   return 0;
 }
 
+static int cmd_detach(char *args)
+{
+  difftest_detach();
+  return 0;
+}
+
+static int cmd_attach(char *args)
+{
+  difftest_attach();
+  return 0;
+}
+
+static int cmd_save(char *args)
+{
+#ifdef CONFIG_SNAPSHOT
+  if (args == NULL)
+  {
+    printf("usage: save FILE\n");
+    return 0;
+  }
+  snapshot_save(args);
+#else
+  printf("snapshot is not enabled\n");
+#endif
+  return 0;
+}
+
+static int cmd_load(char *args)
+{
+#ifdef CONFIG_SNAPSHOT
+  if (args == NULL)
+  {
+    printf("usage: load FILE\n");
+    return 0;
+  }
+  if (snapshot_restore(args))
+  {
+    // the program may continue even if it has ended before
+    nemu_state.state = NEMU_STOP;
+    difftest_sync();
+  }
+#else
+  printf("snapshot is not enabled\n");
+#endif
+  return 0;
+}
+
+static int cmd_trace(char *args)
+{
+#ifdef CONFIG_ACCESS_TRACE
+  char *kind = strtok(args, " ");
+  char *arg1 = strtok(NULL, " ");
+  char *arg2 = strtok(NULL, " ");
+  if (kind == NULL)
+  {
+    trace_display();
+  }
+  else if (strcmp(kind, "mem") == 0 && arg2 != NULL)
+  {
+    paddr_t low = strtoull(arg1, NULL, 0), high = strtoull(arg2, NULL, 0);
+    if (!trace_add_range(low, high))
+      printf("can not trace [" FMT_PADDR ", " FMT_PADDR "]\n", low, high);
+  }
+  else if (strcmp(kind, "dev") == 0 && arg1 != NULL)
+  {
+    if (!trace_add_dev(arg1))
+      printf("can not trace device '%s'\n", arg1);
+  }
+  else if (strcmp(kind, "off") == 0)
+  {
+    trace_clear();
+  }
+  else
+  {
+    printf("usage: trace [mem LOW HIGH | dev NAME | off]\n");
+  }
+#else
+  printf("memory and device tracers are not enabled\n");
+#endif
+  return 0;
+}
+
 static int cmd_info(char *args)
 {
   if (args == NULL)
   {
-    printf("invalid arguments: info r || info w \n");
+    printf("invalid arguments: info r || info w || info b || info perf \n");
     return 0;
   }
 
@@ -228,6 +396,14 @@ static int cmd_info(char *args)
     isa_reg_display();
   else if ( strcmp(args, "w") == 0) {
     print_wp();
+  } else if ( strcmp(args, "b") == 0) {
+    print_bp();
+  } else if ( strcmp(args, "perf") == 0) {
+#ifdef CONFIG_PERF
+    perf_display();
+#else
+    printf("performance counters are not enabled\n");
+#endif
   } else {
     printf("invalid command\n");
   }
@@ -268,6 +444,11 @@ void sdb_set_batch_mode()
   is_batch_mode = true;
 }
 
+void sdb_set_gdb_port(int port)
+{
+  gdb_port = port;
+}
+
 void sdb_mainloop()
 {
   if (is_batch_mode)
@@ -276,6 +457,19 @@ void sdb_mainloop()
     return;
   }
 
+  if (gdb_port != 0)
+  {
+#ifdef CONFIG_GDB_STUB
+    gdb_mainloop(gdb_port);
+    return;
+#else
+    printf("GDB stub is not enabled\n");
+#endif
+  }
+
+  // checkpoints are only taken for the interactive debugging
+  IFDEF(CONFIG_REVERSE_EXEC, checkpoint_enable());
+
   for (char *str; (str = rl_gets()) != NULL;)
   {
     char *str_end = str + strlen(str);
@@ -19,9 +19,36 @@
 #include <common.h>
 
 word_t expr(char *e, bool *success);
+
+/* compiled expressions */
+typedef struct Expr Expr;
+Expr *expr_compile(char *e, bool *success);
+word_t expr_eval(const Expr *e, bool *success);
+void expr_free(Expr *e);
+/* whether `e` is `*ADDR` where ADDR is a constant address in pmem */
+bool expr_watch_addr(const Expr *e, paddr_t *addr);
+
+/* watchpoints and breakpoints share the numbers */
+int sdb_new_no();
+
 void new_wp(char *exp);
-void free_wp(int no);
+bool free_wp(int no);
 void print_wp();
+void wp_pause(bool pause);
+
+void new_bp(vaddr_t pc, char *cond);
+bool free_bp(int no);
+void print_bp();
+bool bp_insert(vaddr_t pc);
+void bp_remove(vaddr_t pc);
+bool bp_inserted(vaddr_t pc);
+
+void gdb_mainloop(int port);
+
+#ifdef CONFIG_REVERSE_EXEC
+void reverse_step(uint64_t n);
+void reverse_continue();
+#endif
 
 #endif
 
@@ -13,6 +13,16 @@
  * See the Mulan PSL v2 for more details.
  ***************************************************************************************/
 
+/* Watchpoints of the form `*ADDR` are memory-range watchpoints. Like those
+ * of hardware debuggers, they are triggered by stores to the watched word
+ * in paddr, and cost nothing on the other instructions. The other
+ * watchpoints are polled after every instruction. Both of them run the
+ * expressions compiled when the watchpoints are set.
+ */
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <memory/paddr.h>
 #include "sdb.h"
 
 #define NR_WP 32
@@ -22,16 +32,15 @@ typedef struct watchpoint
   int NO;
   struct watchpoint *next;
   char expr[256];
-  int value;
-  /* TODO: Add more members if necessary */
-
+  Expr *code;
+  word_t value;
+  bool mem;     // watching the word at addr
+  paddr_t addr;
 } WP;
 
 static WP wp_pool[NR_WP] = {};
 static WP *head = NULL, *free_ = NULL;
-void new_wp(char *exp);
-void free_wp(int no);
-void print_wp();
+int wp_nr_polled = 0; // number of watchpoints polled after every instruction
 
 void init_wp_pool()
 {
@@ -46,63 +55,95 @@ void init_wp_pool()
   free_ = wp_pool;
 }
 
+// the range of memory watched by all memory-range watchpoints
+static void update_watch_range()
+{
+  paddr_t lo = 1, hi = 0; // empty
+  WP *p;
+  wp_nr_polled = 0;
+  for (p = head; p != NULL; p = p->next)
+  {
+    if (!p->mem)
+    {
+      wp_nr_polled++;
+      continue;
+    }
+    if (lo > hi || p->addr < lo)
+      lo = p->addr;
+    if (lo > hi || p->addr + 3 > hi)
+      hi = p->addr + 3;
+  }
+  IFDEF(CONFIG_WATCHPOINT, paddr_watch(lo, hi));
+}
+
 void new_wp(char *exp)
 {
+#ifndef CONFIG_WATCHPOINT
+  printf("watchpoint is not enabled\n");
+  return;
+#endif
   if (free_ == NULL)
   {
     printf("no free_watchpoint\n");
     return;
   }
+  if (strlen(exp) >= sizeof(free_->expr))
+  {
+    printf("expression is too long\n");
+    return;
+  }
 
   bool success = false;
-  int val = expr(exp, &success);
+  Expr *code = expr_compile(exp, &success);
+  if (!success)
+  {
+    return;
+  }
+  word_t val = expr_eval(code, &success);
   if (!success)
   {
+    expr_free(code);
     return;
   }
 
   WP *t = free_;
   free_ = free_->next;
   t->next = NULL;
+  t->NO = sdb_new_no();
+  t->code = code;
   t->value = val;
+  t->mem = expr_watch_addr(code, &t->addr);
   strcpy(t->expr, exp);
 
-  if (head == NULL) {
+  // keep the list in the order of NO
+  if (head == NULL)
     head = t;
-    t->NO = 0;
-  }
   else
   {
     WP *p = head;
     while (p->next)
       p = p->next;
-    
     p->next = t;
-    t->NO = p->NO + 1;
   }
-  return;
+  update_watch_range();
+  printf("%s %d: %s\n", (t->mem ? "Hardware watchpoint" : "Watchpoint"), t->NO, t->expr);
 }
 
-void free_wp(int no)
+bool free_wp(int no)
 {
-  if (head == NULL)
-    return;
-  else if( head->NO == no ) {
-    head = head->next;
-  } else {
-    WP *p = head;
-    WP *q = head->next;
-    while (q != NULL && q->NO != no) {
-      p = p->next;
-      q = q->next;
-    } 
-    if ( q == NULL ) {
-      return;
-    } else {
-      p->next = q->next;
-      free(q);
-    }
-  }
+  WP **p = &head;
+  while (*p != NULL && (*p)->NO != no)
+    p = &(*p)->next;
+  if (*p == NULL)
+    return false;
+  WP *t = *p;
+  *p = t->next;
+  expr_free(t->code);
+  t->code = NULL;
+  t->next = free_;
+  free_ = t;
+  update_watch_range();
+  return true;
 }
 
 void print_wp()
@@ -114,13 +155,68 @@ void print_wp()
   }
   else
   {
+    printf("%-4s %-6s %-24s %s\n", "Num", "Type", "What", "Value");
     while (ptr != NULL)
     {
-      printf("%d   %s  %d\n", ptr->NO, ptr->expr, ptr->value);
+      printf("%-4d %-6s %-24s " FMT_WORD "\n", ptr->NO, (ptr->mem ? "memory" : "expr"), ptr->expr, ptr->value);
       ptr = ptr->next;
     }
   }
 }
 
-/* TODO: Implement the functionality of watchpoint */
+/* Watchpoints are not checked while paused, e.g. when reverse execution
+ * replays the instructions, and their values are refreshed on resume. */
+void wp_pause(bool pause)
+{
+  if (!pause)
+  {
+    WP *p;
+    for (p = head; p != NULL; p = p->next)
+    {
+      bool success;
+      word_t val = expr_eval(p->code, &success);
+      if (success)
+        p->value = val;
+    }
+    update_watch_range();
+    return;
+  }
+  wp_nr_polled = 0;
+  IFDEF(CONFIG_WATCHPOINT, paddr_watch(1, 0));
+}
 
+// stop the machine if the value of the watchpoint changes
+static void check_wp(WP *p)
+{
+  bool success;
+  word_t val = expr_eval(p->code, &success);
+  if (!success || val == p->value)
+    return;
+  printf("\nWatchpoint %d: %s\n\nOld value = " FMT_WORD "\nNew value = " FMT_WORD "\n",
+         p->NO, p->expr, p->value, val);
+  p->value = val;
+  if (nemu_state.state == NEMU_RUNNING)
+    nemu_state.state = NEMU_STOP;
+}
+
+/* Called after every instruction when wp_nr_polled > 0. */
+void wp_poll()
+{
+  WP *p;
+  for (p = head; p != NULL; p = p->next)
+  {
+    if (!p->mem)
+      check_wp(p);
+  }
+}
+
+/* Called after a store to pmem in the range set by paddr_watch(). */
+void wp_store_hook(paddr_t addr, int len)
+{
+  WP *p;
+  for (p = head; p != NULL; p = p->next)
+  {
+    if (p->mem && addr < p->addr + 4 && p->addr < addr + len)
+      check_wp(p);
+  }
+}
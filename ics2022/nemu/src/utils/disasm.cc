@@ -91,7 +91,11 @@ extern "C" void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int
   MCInst inst;
   llvm::ArrayRef<uint8_t> arr(code, nbyte);
   uint64_t dummy_size = 0;
-  gDisassembler->getInstruction(inst, dummy_size, arr, pc, llvm::nulls());
+  // e.g. reserved rounding modes, which trap in the guest, are not decoded by LLVM
+  if (gDisassembler->getInstruction(inst, dummy_size, arr, pc, llvm::nulls()) != MCDisassembler::Success) {
+    snprintf(str, size, "(bad)");
+    return;
+  }
 
   std::string s;
   raw_string_ostream os(s);
@@ -18,3 +18,13 @@ CXXSRC = src/utils/disasm.cc
 CXXFLAGS += $(shell llvm-config-14 --cxxflags) -fPIE
 LIBS += $(shell llvm-config-14 --libs)
 endif
+
+ifndef CONFIG_ACCESS_TRACE
+SRCS-BLACKLIST-y += src/utils/trace.c
+endif
+
+ifdef CONFIG_SNAPSHOT
+LIBS += -lz
+else
+SRCS-BLACKLIST-y += src/utils/snapshot.c
+endif
@@ -0,0 +1,306 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <memory/paddr.h>
+#include <cpu/difftest.h>
+#include <zlib.h>
+
+// A snapshot is a gzip-compressed file with a list of states. Each state is
+// saved as its name, its size and the chunks with non-zero bytes in it, so
+// that a large but mostly untouched state like pmem takes little space. For
+// pmem, the chunks still as they are at reset are skipped instead, and they
+// are regenerated on restore without touching the pages.
+//
+//   state := name_len(u32) name size(u64) chunk* UINT64_MAX(u64)
+//   chunk := offset(u64) data[min(CHUNK_SIZE, size - offset)]
+
+#define SNAPSHOT_MAGIC   "NEMUSNAP"
+#define SNAPSHOT_VERSION 1
+#define CHUNK_SIZE 4096 // a chunk of pmem is in a single page
+#define NR_STATE 32
+
+typedef struct {
+  const char *name;
+  void *buf;
+  size_t size;
+  snapshot_callback_t callback; // called before saving and after restoring
+} SnapshotState;
+
+static SnapshotState states[NR_STATE] = {};
+static int nr_state = 0;
+static uint64_t save_point = -1;
+static const char *save_point_file = NULL;
+
+void snapshot_add(const char *name, void *buf, size_t size, snapshot_callback_t callback) {
+  assert(nr_state < NR_STATE);
+  states[nr_state ++] = (SnapshotState){ .name = name, .buf = buf, .size = size, .callback = callback };
+}
+
+static bool is_pmem(SnapshotState *s) {
+  return s->buf == guest_to_host(PMEM_LEFT);
+}
+
+static SnapshotState* find_state(const char *name) {
+  int i;
+  for (i = 0; i < nr_state; i ++) {
+    if (strcmp(states[i].name, name) == 0) return &states[i];
+  }
+  return NULL;
+}
+
+static void save_state(gzFile fp, SnapshotState *s) {
+  static const uint8_t zero[CHUNK_SIZE] = {};
+  uint32_t name_len = strlen(s->name);
+  uint64_t size = s->size, off;
+
+  if (s->callback != NULL) s->callback(false);
+  gzwrite(fp, &name_len, sizeof(name_len));
+  gzwrite(fp, s->name, name_len);
+  gzwrite(fp, &size, sizeof(size));
+  for (off = 0; off < size; off += CHUNK_SIZE) {
+    uint8_t *chunk = (uint8_t *)s->buf + off;
+    uint32_t len = (size - off < CHUNK_SIZE ? size - off : CHUNK_SIZE);
+    if (is_pmem(s) ? pmem_is_initial(PMEM_LEFT + off, len) : memcmp(chunk, zero, len) == 0) continue;
+    gzwrite(fp, &off, sizeof(off));
+    gzwrite(fp, chunk, len);
+  }
+  off = -1;
+  gzwrite(fp, &off, sizeof(off));
+}
+
+bool snapshot_save(const char *file) {
+  gzFile fp = gzopen(file, "wb");
+  if (fp == NULL) {
+    Log("Can not open snapshot file '%s'", file);
+    return false;
+  }
+
+  uint32_t version = SNAPSHOT_VERSION;
+  gzwrite(fp, SNAPSHOT_MAGIC, STRLEN(SNAPSHOT_MAGIC));
+  gzwrite(fp, &version, sizeof(version));
+  int i;
+  for (i = 0; i < nr_state; i ++) {
+    save_state(fp, &states[i]);
+  }
+
+  if (gzclose(fp) != Z_OK) {
+    Log("Fail to write snapshot file '%s'", file);
+    return false;
+  }
+  Log("Save snapshot to '%s' at pc = " FMT_WORD, file, cpu.pc);
+  return true;
+}
+
+static bool read_all(gzFile fp, void *buf, size_t len) {
+  return gzread(fp, buf, len) == len;
+}
+
+static bool restore_state(gzFile fp, const char *file) {
+  char name[64] = {};
+  uint32_t name_len;
+  uint64_t size, off = 0;
+
+  if (!read_all(fp, &name_len, sizeof(name_len)) || name_len >= sizeof(name) ||
+      !read_all(fp, name, name_len) || !read_all(fp, &size, sizeof(size))) {
+    Log("Snapshot file '%s' is broken", file);
+    return false;
+  }
+
+  SnapshotState *s = find_state(name);
+  if (s == NULL || s->size != size) {
+    Log("State '%s' in snapshot file '%s' does not match this NEMU", name, file);
+    return false;
+  }
+
+  if (is_pmem(s)) pmem_reset();
+  else memset(s->buf, 0, size);
+  // read to a buffer first, since the kernel can not write to pages of pmem not accessed yet
+  static uint8_t chunk[CHUNK_SIZE];
+  while (read_all(fp, &off, sizeof(off)) && off != -1) {
+    uint32_t len = (size - off < CHUNK_SIZE ? size - off : CHUNK_SIZE);
+    if (off >= size || !read_all(fp, chunk, len)) break;
+    memcpy((uint8_t *)s->buf + off, chunk, len);
+  }
+  if (off != -1) {
+    Log("State '%s' in snapshot file '%s' is broken", name, file);
+    return false;
+  }
+  return true;
+}
+
+bool snapshot_restore(const char *file) {
+  gzFile fp = gzopen(file, "rb");
+  if (fp == NULL) {
+    Log("Can not open snapshot file '%s'", file);
+    return false;
+  }
+
+  char magic[STRLEN(SNAPSHOT_MAGIC)];
+  uint32_t version;
+  bool ok = read_all(fp, magic, sizeof(magic)) && memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0 &&
+    read_all(fp, &version, sizeof(version)) && version == SNAPSHOT_VERSION;
+  if (!ok) Log("'%s' is not a snapshot file of this version", file);
+
+  int i;
+  for (i = 0; ok && i < nr_state; i ++) {
+    ok = restore_state(fp, file);
+  }
+  gzclose(fp);
+  if (!ok) return false;
+
+  for (i = 0; i < nr_state; i ++) {
+    if (states[i].callback != NULL) states[i].callback(true);
+  }
+  IFDEF(CONFIG_REVERSE_EXEC, checkpoint_clear());
+  Log("Restore snapshot from '%s' at pc = " FMT_WORD, file, cpu.pc);
+  return true;
+}
+
+void snapshot_save_at(uint64_t nr_inst, const char *file) {
+  save_point = nr_inst;
+  save_point_file = file;
+}
+
+// the number of guest instructions after which a snapshot should be saved
+uint64_t snapshot_save_point() {
+  return save_point;
+}
+
+void snapshot_save_point_hit() {
+  snapshot_save(save_point_file);
+  save_point = -1;
+}
+
+#ifdef CONFIG_REVERSE_EXEC
+/* Checkpoints for reverse execution are kept in memory. A checkpoint has
+ * copies of all the states except pmem, and a state unchanged since the
+ * previous checkpoint is not copied again. For pmem, it has the undo log
+ * of the pages written after it, thus rewinding to a checkpoint applies
+ * the undo logs from the latest checkpoint back to it.
+ */
+
+#define NR_CHECKPOINT CONFIG_REVERSE_EXEC_NR
+
+typedef struct {
+  uint64_t nr_inst;
+  void *state[NR_STATE]; // NULL if it is the same as the previous checkpoint
+  PmemUndo *undo;
+} Checkpoint;
+
+static Checkpoint ckpt[NR_CHECKPOINT] = {};
+static int nr_ckpt = 0;
+static uint64_t next_ckpt = -1;
+
+// the copy of state `i` in checkpoint `k`
+static void* ckpt_state(int k, int i) {
+  for (; ckpt[k].state[i] == NULL; k --) assert(k > 0);
+  return ckpt[k].state[i];
+}
+
+static void ckpt_free(Checkpoint *c) {
+  int i;
+  for (i = 0; i < nr_state; i ++) free(c->state[i]);
+  if (c->undo != NULL) pmem_undo_free(c->undo);
+  memset(c, 0, sizeof(*c));
+}
+
+/* Take checkpoints every CONFIG_REVERSE_EXEC_INTERVAL instructions from now on. */
+void checkpoint_enable() {
+  if (next_ckpt == -1) next_ckpt = g_nr_guest_inst;
+}
+
+uint64_t checkpoint_next() {
+  return next_ckpt;
+}
+
+uint64_t checkpoint_oldest() {
+  return (nr_ckpt > 0 ? ckpt[0].nr_inst : -1);
+}
+
+/* Take a checkpoint now, return the time to take the next one. */
+uint64_t checkpoint_take() {
+  if (nr_ckpt == NR_CHECKPOINT) {
+    // drop the oldest one, and move its copies to the next one if they are shared
+    int i;
+    for (i = 0; i < nr_state; i ++) {
+      if (ckpt[1].state[i] == NULL) { ckpt[1].state[i] = ckpt[0].state[i]; ckpt[0].state[i] = NULL; }
+    }
+    ckpt_free(&ckpt[0]);
+    memmove(&ckpt[0], &ckpt[1], sizeof(ckpt[0]) * (NR_CHECKPOINT - 1));
+    memset(&ckpt[NR_CHECKPOINT - 1], 0, sizeof(ckpt[0]));
+    nr_ckpt --;
+  }
+
+  int k = nr_ckpt ++, i;
+  Checkpoint *c = &ckpt[k];
+  c->nr_inst = g_nr_guest_inst;
+  for (i = 0; i < nr_state; i ++) {
+    SnapshotState *s = &states[i];
+    if (is_pmem(s)) continue;
+    if (s->callback != NULL) s->callback(false);
+    if (k > 0 && memcmp(ckpt_state(k - 1, i), s->buf, s->size) == 0) continue;
+    c->state[i] = malloc(s->size);
+    assert(c->state[i]);
+    memcpy(c->state[i], s->buf, s->size);
+  }
+  c->undo = pmem_undo_begin();
+  next_ckpt = g_nr_guest_inst + CONFIG_REVERSE_EXEC_INTERVAL;
+  return next_ckpt;
+}
+
+/* Restore the latest checkpoint taken no later than `nr_inst`, and drop
+ * the checkpoints after it. Return false if there is no such checkpoint. */
+bool checkpoint_rewind(uint64_t nr_inst) {
+  int k = nr_ckpt - 1, j, i;
+  while (k >= 0 && ckpt[k].nr_inst > nr_inst) k --;
+  if (k < 0) return false;
+
+  for (j = nr_ckpt - 1; j >= k; j --) pmem_undo_apply(ckpt[j].undo);
+  for (j = nr_ckpt - 1; j > k; j --) ckpt_free(&ckpt[j]);
+  pmem_undo_free(ckpt[k].undo);
+  nr_ckpt = k + 1;
+
+  for (i = 0; i < nr_state; i ++) {
+    SnapshotState *s = &states[i];
+    if (is_pmem(s)) continue;
+    memcpy(s->buf, ckpt_state(k, i), s->size);
+  }
+  for (i = 0; i < nr_state; i ++) {
+    if (states[i].callback != NULL) states[i].callback(true);
+  }
+  ckpt[k].undo = pmem_undo_begin();
+  next_ckpt = ckpt[k].nr_inst + CONFIG_REVERSE_EXEC_INTERVAL;
+  return true;
+}
+
+/* Drop all the checkpoints and their undo logs, e.g. after the machine
+ * state is replaced by a snapshot, since they belong to another timeline.
+ * If checkpoints are enabled, the next one is taken right away. */
+void checkpoint_clear() {
+  int k;
+  for (k = nr_ckpt - 1; k >= 0; k --) ckpt_free(&ckpt[k]);
+  nr_ckpt = 0;
+  if (next_ckpt != -1) next_ckpt = g_nr_guest_inst;
+}
+#endif
+
+void init_snapshot() {
+  snapshot_add("cpu", &cpu, sizeof(cpu), NULL);
+  snapshot_add("nr_guest_inst", &g_nr_guest_inst, sizeof(g_nr_guest_inst), NULL);
+  IFDEF(CONFIG_PERF, snapshot_add("perf", &nemu->perf, sizeof(nemu->perf), NULL));
+  IFDEF(CONFIG_VIRTUAL_TIME, snapshot_add("nr_idle_cycle", &nemu->nr_idle_cycle, sizeof(nemu->nr_idle_cycle), NULL));
+  snapshot_add("pmem", guest_to_host(PMEM_LEFT), CONFIG_MSIZE, NULL);
+}
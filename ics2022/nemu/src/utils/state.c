@@ -13,9 +13,59 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
-#include <utils.h>
+#include <instance.h>
 
-NEMUState nemu_state = { .state = NEMU_STOP };
+void init_mem();
+void free_mem();
+
+// the instance initialized by the monitor, and the current one of every new thread
+static NEMUInstance nemu_default = { .state = { .state = NEMU_STOP } };
+NEMU_TLS NEMUInstance *nemu = &nemu_default;
+
+/* Create an instance with its own memory and CPU, but without devices. */
+NEMUInstance* nemu_new() {
+  NEMUInstance *instance = calloc(1, sizeof(*instance));
+  assert(instance);
+  instance->state.state = NEMU_STOP;
+  NEMUInstance *old = nemu_switch(instance);
+  init_mem();
+  init_isa();
+  nemu_switch(old);
+  return instance;
+}
+
+/* Create another hart of the current instance, sharing its memory and devices. */
+NEMUInstance* nemu_new_hart(int hartid) {
+  NEMUInstance *instance = calloc(1, sizeof(*instance));
+  assert(instance);
+  instance->state.state = NEMU_STOP;
+  instance->pmem = nemu->pmem;
+  instance->pmem_ready = nemu->pmem_ready;
+  instance->pmem_fd = nemu->pmem_fd;
+  instance->pmem_dirty = nemu->pmem_dirty;
+  instance->pmem_store = nemu->pmem_store;
+  instance->io = nemu->io;
+  instance->keyboard = nemu->keyboard;
+  NEMUInstance *old = nemu_switch(instance);
+  init_isa_hart(hartid);
+  nemu_switch(old);
+  return instance;
+}
+
+void nemu_free(NEMUInstance *instance) {
+  assert(instance != &nemu_default && instance != nemu);
+  NEMUInstance *old = nemu_switch(instance);
+  free_mem();
+  nemu_switch(old);
+  free(instance);
+}
+
+/* Make `instance` the current one of the calling thread, and return the old one. */
+NEMUInstance* nemu_switch(NEMUInstance *instance) {
+  NEMUInstance *old = nemu;
+  nemu = instance;
+  return old;
+}
 
 int is_exit_status_bad() {
   int good = (nemu_state.state == NEMU_END && nemu_state.halt_ret == 0) ||
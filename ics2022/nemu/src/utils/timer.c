@@ -13,7 +13,7 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
-#include <common.h>
+#include <isa.h>
 #include MUXDEF(CONFIG_TIMER_GETTIMEOFDAY, <sys/time.h>, <time.h>)
 
 IFDEF(CONFIG_TIMER_CLOCK_GETTIME,
@@ -43,3 +43,15 @@ uint64_t get_time() {
   uint64_t now = get_time_internal();
   return now - boot_time;
 }
+
+/* The time seen by the guest, unit: us. With CONFIG_VIRTUAL_TIME, it is the
+ * time of the cycles of the current hart at the nominal frequency, so that
+ * it does not depend on the load of the host. */
+uint64_t get_guest_time() {
+#ifdef CONFIG_VIRTUAL_TIME
+  uint64_t n = g_nr_guest_cycle, f = CONFIG_VIRTUAL_TIME_FREQ;
+  return n / f * 1000000 + n % f * 1000000 / f;
+#else
+  return get_time();
+#endif
+}
@@ -0,0 +1,151 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* The memory and device tracer. Instead of formatting every access into
+ * the log, the accesses passing the filters are recorded in binary to a
+ * buffer of the thread, which is written to the trace file when it is full
+ * and at the end of every cpu_exec(). Without filters, nothing is traced
+ * and the cost is one check per access.
+ */
+
+#include <isa.h>
+#include <device/map.h>
+#ifdef CONFIG_SMP
+#include <pthread.h>
+#endif
+
+#define NR_RANGE 8
+#define NR_RECORD 4096 // records in the buffer of a thread
+
+static struct { paddr_t low, high; } range[NR_RANGE];
+int trace_nr_range = 0;
+
+static const char *trace_file = "nemu-trace.bin";
+static FILE *trace_fp = NULL;
+static uint64_t nr_written = 0;
+IFDEF(CONFIG_SMP, static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER);
+
+static __thread TraceRecord *buf = NULL;
+static __thread int nr_buf = 0;
+
+void trace_set_file(const char *file) {
+  trace_file = file;
+}
+
+// the k-th map of devices, MMIO ones first, NULL if there is no such map
+static IOMap* dev_map(int k) {
+#ifdef CONFIG_DEVICE
+  IOState *io = nemu->io;
+  if (k < io->nr_mmio_map) return &io->mmio_maps[k];
+  k -= io->nr_mmio_map;
+  if (k < io->nr_pio_map) return &io->pio_maps[k];
+#endif
+  return NULL;
+}
+
+// the header describes the devices at the time the file is opened
+static bool trace_open() {
+  trace_fp = fopen(trace_file, "wb");
+  if (trace_fp == NULL) {
+    Log("Can not open trace file '%s'", trace_file);
+    return false;
+  }
+  TraceHeader h = { .magic = "NEMUTRC", .record_size = sizeof(TraceRecord) };
+  TraceDev dev[2 * NR_MAP] = {};
+  IOMap *m;
+  for (; (m = dev_map(h.nr_dev)) != NULL; h.nr_dev ++) {
+    strncpy(dev[h.nr_dev].name, m->name, sizeof(dev[0].name) - 1);
+    dev[h.nr_dev].low = m->low;
+    dev[h.nr_dev].high = m->high;
+  }
+  fwrite(&h, sizeof(h), 1, trace_fp);
+  fwrite(dev, sizeof(dev[0]), h.nr_dev, trace_fp);
+  Log("Trace is written to %s", trace_file);
+  return true;
+}
+
+void trace_flush() {
+  if (nr_buf == 0) return;
+  IFDEF(CONFIG_SMP, pthread_mutex_lock(&trace_lock));
+  if (trace_fp != NULL || trace_open()) {
+    fwrite(buf, sizeof(buf[0]), nr_buf, trace_fp);
+    fflush(trace_fp);
+    nr_written += nr_buf;
+  }
+  IFDEF(CONFIG_SMP, pthread_mutex_unlock(&trace_lock));
+  nr_buf = 0;
+  // the harts of SMP run on new threads in every cpu_exec()
+  free(buf);
+  buf = NULL;
+}
+
+void trace_record(int type, paddr_t addr, int len, word_t data) {
+  if (unlikely(buf == NULL)) {
+    buf = malloc(sizeof(buf[0]) * NR_RECORD);
+    assert(buf);
+  }
+  buf[nr_buf ++] = (TraceRecord){ .nr_inst = g_nr_guest_inst, .pc = cpu.pc,
+    .addr = addr, .data = data, .type = type, .len = len };
+  if (nr_buf == NR_RECORD) {
+    trace_flush();
+  }
+}
+
+void trace_mem(int type, paddr_t addr, int len, word_t data) {
+  int i;
+  for (i = 0; i < trace_nr_range; i ++) {
+    if (addr + len - 1 >= range[i].low && addr <= range[i].high) {
+      trace_record(type, addr, len, data);
+      return;
+    }
+  }
+}
+
+bool trace_add_range(paddr_t low, paddr_t high) {
+  if (!ISDEF(CONFIG_MTRACE) || trace_nr_range == NR_RANGE || low > high) return false;
+  range[trace_nr_range].low = low;
+  range[trace_nr_range].high = high;
+  trace_nr_range ++;
+  return true;
+}
+
+bool trace_add_dev(const char *name) {
+  bool found = false;
+  IOMap *m;
+  int k;
+  for (k = 0; ISDEF(CONFIG_DTRACE) && (m = dev_map(k)) != NULL; k ++) {
+    if (strcmp(m->name, name) == 0) found = m->traced = true;
+  }
+  return found;
+}
+
+void trace_clear() {
+  IOMap *m;
+  int k;
+  trace_nr_range = 0;
+  for (k = 0; (m = dev_map(k)) != NULL; k ++) m->traced = false;
+}
+
+void trace_display() {
+  IOMap *m;
+  int i;
+  for (i = 0; i < trace_nr_range; i ++) {
+    printf("mem [" FMT_PADDR ", " FMT_PADDR "]\n", range[i].low, range[i].high);
+  }
+  for (i = 0; (m = dev_map(i)) != NULL; i ++) {
+    if (m->traced) printf("dev %s\n", m->name);
+  }
+  printf("%" PRIu64 " records written to %s\n", nr_written, trace_file);
+}
@@ -0,0 +1,89 @@
+#***************************************************************************************
+# Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+#
+# NEMU is licensed under Mulan PSL v2.
+# You can use this software according to the terms and conditions of the Mulan PSL v2.
+# You may obtain a copy of Mulan PSL v2 at:
+#          http://license.coscl.org.cn/MulanPSL2
+#
+# THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+# EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+# MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+#
+# See the Mulan PSL v2 for more details.
+#**************************************************************************************/
+
+# Check --diff-ff with ff.S: NEMU runs the image under the GDB stub, which
+# corrupts t1 of DUT only, at a breakpoint before or after `ff_pc`.
+# usage: python3 ff.py NEMU REF_SO IMAGE.elf IMAGE.bin
+
+import socket, struct, subprocess, sys, time
+
+def symbols(elf):
+  data = open(elf, 'rb').read()
+  shoff, = struct.unpack_from('<I', data, 0x20)
+  shentsize, shnum = struct.unpack_from('<HH', data, 0x2e)
+  sh = [struct.unpack_from('<IIIIIIIIII', data, shoff + i * shentsize) for i in range(shnum)]
+  syms = {}
+  for s in sh:
+    if s[1] != 2: continue  # SHT_SYMTAB
+    strtab = sh[s[6]]
+    for off in range(s[4], s[4] + s[5], 16):
+      name, value = struct.unpack_from('<II', data, off)
+      end = data.index(b'\0', strtab[4] + name)
+      syms[data[strtab[4] + name:end].decode()] = value
+  return syms
+
+class Gdb:
+  def __init__(self, port):
+    for _ in range(100):
+      try:
+        self.s = socket.create_connection(('127.0.0.1', port))
+        break
+      except ConnectionRefusedError:
+        time.sleep(0.1)
+    self.buf = b''
+
+  def cmd(self, p):
+    self.s.sendall(b'$%s#%02x' % (p.encode(), sum(p.encode()) & 0xff))
+    while True:
+      i = self.buf.find(b'#')
+      if i >= 0 and len(self.buf) >= i + 3:
+        pkt = self.buf[self.buf.index(b'$') + 1:i]
+        self.buf = self.buf[i + 3:]
+        self.s.sendall(b'+')
+        return pkt.decode()
+      d = self.s.recv(4096)
+      if not d: return None
+      self.buf += d
+
+def run(nemu, ref, bin, ff_pc, bp, port):
+  args = [nemu, '-l', '/dev/null', '--diff=' + ref, '--diff-ff=0x%x' % ff_pc, '--gdb=%d' % port, bin]
+  p = subprocess.Popen(args, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+  g = Gdb(port)
+  assert g.cmd('Z0,%x,4' % bp) == 'OK'
+  stop = g.cmd('c')
+  assert stop.startswith('S05'), stop
+  assert g.cmd('P6=%s' % struct.pack('<I', 0x100).hex()) == 'OK'  # t1
+  assert g.cmd('z0,%x,4' % bp) == 'OK'
+  stop = g.cmd('c')
+  g.cmd('k')
+  out = p.communicate(timeout=60)[0]
+  return stop, out
+
+def check(name, ok, out):
+  print('%-40s %s' % (name, 'PASS' if ok else 'FAIL'))
+  if not ok:
+    print(out)
+    sys.exit(1)
+
+nemu, ref, elf, bin = sys.argv[1:5]
+sym = symbols(elf)
+port = 12000 + (time.time_ns() // 1000) % 10000
+
+stop, out = run(nemu, ref, bin, sym['ff_pc'], sym['before'], port)
+check('corrupt before ff_pc, not checked', stop == 'W00' and
+    'REF catches up with DUT after 2003 instructions' in out, out)
+
+stop, out = run(nemu, ref, bin, sym['ff_pc'], sym['after'], port + 1)
+check('corrupt after ff_pc, caught', stop == 'X06', out)
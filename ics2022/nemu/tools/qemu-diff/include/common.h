@@ -17,6 +17,7 @@
 #define __COMMON_H__
 
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <assert.h>
 #include <string.h>
@@ -56,4 +56,10 @@ union isa_gdb_regs {
   };
 };
 
+#if defined(CONFIG_ISA_x86)
+#define GDB_PC(r) ((r).eip)
+#else
+#define GDB_PC(r) ((r).pc)
+#endif
+
 #endif
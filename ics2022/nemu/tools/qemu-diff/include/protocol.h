@@ -28,10 +28,20 @@ uint8_t hex_encode(uint8_t digit);
 
 struct gdb_conn *gdb_begin_inet(const char *addr, uint16_t port);
 
+struct gdb_conn *gdb_begin_server(const char *addr, uint16_t port);
+
 void gdb_end(struct gdb_conn *conn);
 
 void gdb_send(struct gdb_conn *conn, const uint8_t *command, size_t size);
 
+void gdb_send_nowait(struct gdb_conn *conn, const uint8_t *command, size_t size);
+
+size_t gdb_escape_binary(uint8_t *dst, const uint8_t *src, size_t size);
+
 uint8_t *gdb_recv(struct gdb_conn *conn, size_t *size);
 
 const char * gdb_start_noack(struct gdb_conn *conn);
+
+void gdb_set_ack(struct gdb_conn *conn, bool ack);
+
+bool gdb_poll_interrupt(struct gdb_conn *conn);
@@ -20,19 +20,23 @@
 
 bool gdb_connect_qemu(int);
 bool gdb_memcpy_to_qemu(uint32_t, void *, int);
+bool gdb_memcpy_from_qemu(uint32_t, void *, int);
 bool gdb_getregs(union isa_gdb_regs *);
 bool gdb_setregs(union isa_gdb_regs *);
-bool gdb_si();
+bool gdb_step(uint64_t n);
+bool gdb_run_until(uint64_t pc);
 void gdb_exit();
 
 void init_isa();
 
 void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
-  assert(direction == DIFFTEST_TO_REF);
+  bool ok;
   if (direction == DIFFTEST_TO_REF) {
-    bool ok = gdb_memcpy_to_qemu(addr, buf, n);
-    assert(ok == 1);
+    ok = gdb_memcpy_to_qemu(addr, buf, n);
+  } else {
+    ok = gdb_memcpy_from_qemu(addr, buf, n);
   }
+  assert(ok == 1);
 }
 
 void difftest_regcpy(void *dut, bool direction) {
@@ -47,7 +51,18 @@ void difftest_regcpy(void *dut, bool direction) {
 }
 
 void difftest_exec(uint64_t n) {
-  while (n --) gdb_si();
+  if (!gdb_step(n)) {
+    printf("QEMU does not stop normally after stepping\n");
+    assert(0);
+  }
+}
+
+// the optional interface to run until `pc`, see ff_attach() in NEMU
+void difftest_exec_until(uint64_t pc) {
+  if (!gdb_run_until(pc)) {
+    printf("QEMU does not stop normally at pc = 0x%" PRIx64 "\n", pc);
+    assert(0);
+  }
 }
 
 void difftest_init(int port) {
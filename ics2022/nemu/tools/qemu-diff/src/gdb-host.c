@@ -17,12 +17,62 @@
 
 static struct gdb_conn *conn;
 
+// Requests are pipelined in no-ack mode: up to MAX_INFLIGHT requests are
+// sent before their replies are received, to hide the round-trip latency.
+// Otherwise the reply of a request must be received before sending the next
+// one, since the ACK of the next request can not be told from the reply.
+// Steps are never pipelined, see gdb_step().
+#define MAX_INFLIGHT 64
+static bool pipeline = false;
+static int nr_inflight = 0;
+static int packet_size = 1500; // the max size of a packet accepted by QEMU
+static enum { BINARY_UNKNOWN, BINARY_OK, BINARY_NO } binary = BINARY_UNKNOWN;
+
+static uint8_t* wait_reply() {
+  size_t size;
+  assert(nr_inflight > 0);
+  nr_inflight --;
+  return gdb_recv(conn, &size);
+}
+
+static bool wait_reply_ok() {
+  uint8_t *reply = wait_reply();
+  bool ok = !strcmp((const char*)reply, "OK");
+  free(reply);
+  return ok;
+}
+
+static bool window_full() {
+  return nr_inflight == (pipeline ? MAX_INFLIGHT : 1);
+}
+
+// send a request, the reply should be received with wait_reply() in order,
+// the caller should make room in the window if the reply is not just "OK"
+static bool request(const char *cmd, size_t size) {
+  bool ok = true;
+  if (window_full()) ok = wait_reply_ok();
+  if (pipeline) gdb_send_nowait(conn, (const uint8_t *)cmd, size);
+  else gdb_send(conn, (const uint8_t *)cmd, size);
+  nr_inflight ++;
+  return ok;
+}
+
+static void query_packet_size() {
+  request("qSupported", 10);
+  uint8_t *reply = wait_reply();
+  char *p = strstr((const char *)reply, "PacketSize=");
+  if (p != NULL) packet_size = strtol(p + 11, NULL, 16);
+  free(reply);
+}
+
 bool gdb_connect_qemu(int port) {
   // connect to gdbserver on localhost port 1234
   while ((conn = gdb_begin_inet("127.0.0.1", port)) == NULL) {
     usleep(1);
   }
 
+  pipeline = !strcmp(gdb_start_noack(conn), "OK");
+  query_packet_size();
   return true;
 }
 
@@ -35,27 +85,76 @@ static bool gdb_memcpy_to_qemu_small(uint32_t dest, void *src, int len) {
     p += sprintf(buf + p, "%c%c", hex_encode(((uint8_t *)src)[i] >> 4), hex_encode(((uint8_t *)src)[i] & 0xf));
   }
 
-  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+  bool ok = request(buf, p);
   free(buf);
+  return ok;
+}
 
-  size_t size;
-  uint8_t *reply = gdb_recv(conn, &size);
-  bool ok = !strcmp((const char*)reply, "OK");
-  free(reply);
+static bool gdb_memcpy_to_qemu_binary(uint32_t dest, void *src, int len) {
+  char *buf = malloc(len * 2 + 128);
+  assert(buf != NULL);
+  int p = sprintf(buf, "X%x,%x:", dest, len);
+  p += gdb_escape_binary((uint8_t *)buf + p, src, len);
 
+  bool ok = request(buf, p);
+  free(buf);
   return ok;
 }
 
+static bool binary_supported(uint32_t dest) {
+  if (binary == BINARY_UNKNOWN) {
+    // probe with an empty write as GDB does, QEMU replies an empty packet if
+    // 'X' is not supported
+    gdb_memcpy_to_qemu_binary(dest, NULL, 0);
+    binary = (wait_reply_ok() ? BINARY_OK : BINARY_NO);
+  }
+  return binary == BINARY_OK;
+}
+
 bool gdb_memcpy_to_qemu(uint32_t dest, void *src, int len) {
-  const int mtu = 1500;
+  bool is_binary = binary_supported(dest);
+  // the data after escaping or encoding is at most twice as large
+  const int mtu = (packet_size - 32) / 2;
+  bool ok = true;
+  while (len > 0) {
+    int n = (len > mtu ? mtu : len);
+    ok &= (is_binary ? gdb_memcpy_to_qemu_binary(dest, src, n) : gdb_memcpy_to_qemu_small(dest, src, n));
+    dest += n;
+    src += n;
+    len -= n;
+  }
+  while (nr_inflight > 0) ok &= wait_reply_ok();
+  return ok;
+}
+
+// decode the hex-encoded reply of 'm' to `*dest` and move it forward
+static bool wait_reply_mem(uint8_t **dest) {
+  uint8_t *reply = wait_reply();
+  bool ok = reply[0] != 'E';
+  if (ok) {
+    int i, len = strlen((const char *)reply) / 2;
+    for (i = 0; i < len; i ++) {
+      (*dest)[i] = gdb_decode_hex(reply[i * 2], reply[i * 2 + 1]);
+    }
+    *dest += len;
+  }
+  free(reply);
+  return ok;
+}
+
+bool gdb_memcpy_from_qemu(uint32_t src, void *dest, int len) {
+  const int mtu = (packet_size - 32) / 2;
+  uint8_t *p = dest;
+  char buf[64];
   bool ok = true;
-  while (len > mtu) {
-    ok &= gdb_memcpy_to_qemu_small(dest, src, mtu);
-    dest += mtu;
-    src += mtu;
-    len -= mtu;
+  while (len > 0) {
+    int n = (len > mtu ? mtu : len);
+    if (window_full()) ok &= wait_reply_mem(&p);
+    request(buf, sprintf(buf, "m%x,%x", src, n));
+    src += n;
+    len -= n;
   }
-  ok &= gdb_memcpy_to_qemu_small(dest, src, len);
+  while (nr_inflight > 0) ok &= wait_reply_mem(&p);
   return ok;
 }
 
@@ -104,13 +203,46 @@ bool gdb_setregs(union isa_gdb_regs *r) {
   return ok;
 }
 
-bool gdb_si() {
-  char buf[] = "vCont;s:1";
-  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
-  size_t size;
-  uint8_t *reply = gdb_recv(conn, &size);
-  free(reply);
-  return true;
+// While the target runs, the client may send nothing but ^C, and QEMU
+// drops any other byte arriving then. So every step waits for its stop
+// reply before the next one is sent, which still saves the ACKs in no-ack
+// mode. Return false if a step does not stop normally.
+bool gdb_step(uint64_t n) {
+  static const char cmd[] = "vCont;s:1";
+  bool ok = true;
+  assert(nr_inflight == 0);
+  while (n --) {
+    request(cmd, sizeof(cmd) - 1);
+    uint8_t *reply = wait_reply();
+    ok &= (reply[0] == 'T' || reply[0] == 'S');
+    free(reply);
+  }
+  return ok;
+}
+
+// Run to the first time `pc` is reached after at least one step, with a
+// temporary breakpoint, so it takes a few round trips instead of one per
+// instruction. Unlike stepping, QEMU does not mask interrupts and timers
+// while the target runs. Return false if the target does not stop normally.
+bool gdb_run_until(uint64_t pc) {
+  char buf[64];
+  union isa_gdb_regs r;
+  bool ok = gdb_step(1);
+  gdb_getregs(&r);
+  if (!ok || GDB_PC(r) == pc) return ok;
+
+  // the kind of a software breakpoint is ignored by QEMU
+  request(buf, sprintf(buf, "Z0,%" PRIx64 ",4", pc));
+  ok = wait_reply_ok();
+  if (ok) {
+    request("c", 1);
+    uint8_t *reply = wait_reply();
+    ok = (reply[0] == 'T' || reply[0] == 'S');
+    free(reply);
+    request(buf, sprintf(buf, "z0,%" PRIx64 ",4", pc));
+    ok &= wait_reply_ok();
+  }
+  return ok;
 }
 
 void gdb_exit() {
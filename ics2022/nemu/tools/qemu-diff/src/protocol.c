@@ -20,6 +20,8 @@
 #include "common.h"
 #include <ctype.h>
 #include <err.h>
+#include <poll.h>
+#include <unistd.h>
 
 #include <arpa/inet.h>
 
@@ -128,6 +130,38 @@ struct gdb_conn* gdb_begin_inet(const char *addr, uint16_t port) {
   return gdb_begin(fd);
 }
 
+// wait for a client on the port, used by the stub built into NEMU
+struct gdb_conn* gdb_begin_server(const char *addr, uint16_t port) {
+  struct sockaddr_in sa = {
+    .sin_family = AF_INET,
+    .sin_port = htons(port),
+  };
+  if (inet_aton(addr, &sa.sin_addr) == 0)
+    errx(1, "Invalid address: %s", addr);
+
+  int sfd = socket(AF_INET, SOCK_STREAM, 0);
+  if (sfd < 0)
+    err(1, "socket");
+  int tmp = 1;
+  if (setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, (char *)&tmp, sizeof(tmp)) != 0)
+    err(1, "setsockopt");
+  if (bind(sfd, (const struct sockaddr *)&sa, sizeof(sa)) != 0)
+    err(1, "bind");
+  if (listen(sfd, 1) != 0)
+    err(1, "listen");
+
+  int fd = accept(sfd, NULL, NULL);
+  if (fd < 0)
+    err(1, "accept");
+  close(sfd);
+
+  tmp = 1;
+  if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char *)&tmp, sizeof(tmp)) != 0)
+    err(1, "setsockopt");
+
+  return gdb_begin(fd);
+}
+
 
 void gdb_end(struct gdb_conn *conn) {
   fclose(conn->in);
@@ -135,7 +169,7 @@ void gdb_end(struct gdb_conn *conn) {
   free(conn);
 }
 
-static void send_packet(FILE *out, const uint8_t *command, size_t size) {
+static void send_packet(FILE *out, const uint8_t *command, size_t size, bool flush) {
   // compute the checksum -- simple mod256 addition
   uint8_t sum = 0;
   size_t i;
@@ -149,7 +183,8 @@ static void send_packet(FILE *out, const uint8_t *command, size_t size) {
   fputc('$', out); // packet start
   fwrite(command, 1, size, out); // payload
   fprintf(out, "#%02X", sum); // packet end, checksum
-  fflush(out);
+  if (flush)
+    fflush(out);
 
   if (ferror(out))
     err(1, "send");
@@ -160,7 +195,7 @@ static void send_packet(FILE *out, const uint8_t *command, size_t size) {
 void gdb_send(struct gdb_conn *conn, const uint8_t *command, size_t size) {
   bool acked = false;
   do {
-    send_packet(conn->out, command, size);
+    send_packet(conn->out, command, size, true);
 
     if (!conn->ack)
       break;
@@ -170,6 +205,29 @@ void gdb_send(struct gdb_conn *conn, const uint8_t *command, size_t size) {
   } while (!acked);
 }
 
+// Send a packet without waiting for anything. The output is only flushed
+// before receiving a reply, so that several packets can be sent at once.
+// This is only valid in no-ack mode.
+void gdb_send_nowait(struct gdb_conn *conn, const uint8_t *command, size_t size) {
+  assert(!conn->ack);
+  send_packet(conn->out, command, size, false);
+}
+
+// escape binary data for packets like 'X', return the size after escaping,
+// which is at most twice of the original size
+size_t gdb_escape_binary(uint8_t *dst, const uint8_t *src, size_t size) {
+  size_t i, j = 0;
+  for (i = 0; i < size; i ++) {
+    uint8_t c = src[i];
+    if (c == '#' || c == '$' || c == '}' || c == '*') {
+      dst[j ++] = '}';
+      c ^= 0x20;
+    }
+    dst[j ++] = c;
+  }
+  return j;
+}
+
 static uint8_t* recv_packet(FILE *in, size_t *ret_size, bool* ret_sum_ok) {
   size_t i = 0;
   size_t size = 4096;
@@ -276,6 +334,9 @@ static uint8_t* recv_packet(FILE *in, size_t *ret_size, bool* ret_sum_ok) {
 uint8_t* gdb_recv(struct gdb_conn *conn, size_t *size) {
   uint8_t *reply;
   bool acked = false;
+
+  // packets sent by gdb_send_nowait() may be still buffered
+  fflush(conn->out);
   do {
     reply = recv_packet(conn->in, size, &acked);
 
@@ -290,6 +351,22 @@ uint8_t* gdb_recv(struct gdb_conn *conn, size_t *size) {
   return reply;
 }
 
+// the stub turns off acks after replying to QStartNoAckMode
+/* Whether an interrupt (0x03) is received, without blocking. It is sent
+ * outside of packets while the target is running, and may have been read
+ * into the buffer of the stream along with the last packet. */
+bool gdb_poll_interrupt(struct gdb_conn *conn) {
+  if (conn->in->_IO_read_ptr == conn->in->_IO_read_end) {
+    struct pollfd pfd = { .fd = fileno(conn->in), .events = POLLIN };
+    if (poll(&pfd, 1, 0) <= 0) return false;
+  }
+  return fgetc(conn->in) == 0x03;
+}
+
+void gdb_set_ack(struct gdb_conn *conn, bool ack) {
+  conn->ack = ack;
+}
+
 const char* gdb_start_noack(struct gdb_conn *conn) {
   static const char cmd[] = "QStartNoAckMode";
   gdb_send(conn, (const uint8_t *)cmd, sizeof(cmd) - 1);
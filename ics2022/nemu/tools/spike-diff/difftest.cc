@@ -19,7 +19,7 @@
 
 #ifdef CONFIG_ISA_riscv32
 #undef DEFAULT_ISA
-#define DEFAULT_ISA "RV32IM"
+#define DEFAULT_ISA "RV32IMAC"
 #endif
 
 static std::vector<std::pair<reg_t, abstract_device_t*>> difftest_plugin_devices;
@@ -85,7 +85,10 @@ void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
   if (direction == DIFFTEST_TO_REF) {
     s->diff_memcpy(addr, buf, n);
   } else {
-    assert(0);
+    mmu_t* mmu = p->get_mmu();
+    for (size_t i = 0; i < n; i++) {
+      *((uint8_t*)buf+i) = mmu->load_uint8(addr+i);
+    }
   }
 }
 